@@ -0,0 +1,298 @@
+// Load generator for the framed protocol.
+//
+// Each connection logs in as its own customer and keeps up to -P requests in
+// flight for -d seconds. The report gives throughput, latency percentiles and,
+// from SERVER_STATS taken before and after the run, the database syscalls the
+// server made per request for every opcode the run used.
+//
+//   ./bench -c 16 -d 10 -m mixed -P 4
+//   ./bench -E 2001 -c 32        (creates 32 customers through employee 2001 first)
+//
+// `make bench-modes` runs the same load against a fresh database with the
+// server in its default shared locking mode and then in single-owner mode (-X).
+#include "common.h"
+#include "proto.h"
+#include <signal.h>
+#include <stdint.h>
+
+static const char* cfg_host = "127.0.0.1";
+static int cfg_conns = 8;           // -c
+static int cfg_seconds = 5;         // -d
+static const char* cfg_mix = "balance"; // -m: balance, deposit, transfer, history or mixed
+static int cfg_first_id = 1001;     // -u: customers are first_id .. first_id + conns - 1
+static const char* cfg_password = "pass"; // -p
+static int cfg_pipeline = 1;        // -P: requests in flight per connection
+static int cfg_employee = 0;        // -E: create the customers through this employee
+
+typedef struct {
+    int sock;
+    int customer_id;
+    int peer_id;            // transfer recipient
+    uint8_t rbuf[PROTO_MAX_FRAME];
+    uint64_t* latencies;    // ns, one per completed request
+    size_t count, cap;
+    unsigned long errors;
+    pthread_t tid;
+} BenchConn;
+
+static volatile int running = 1;
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_server(void) {
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) { perror("socket"); return -1; }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    if (inet_pton(AF_INET, cfg_host, &addr.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect"); close(sock); return -1;
+    }
+    return sock;
+}
+
+static int send_frame(int sock, const Request* req, uint32_t id) {
+    uint8_t frame[PROTO_MAX_FRAME];
+    size_t len = proto_encode_request(req, id, frame, sizeof(frame));
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(sock, frame + off, len - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        off += (size_t)n;
+    }
+    return len > 0;
+}
+
+static int read_full(int sock, uint8_t* buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = read(sock, buf + off, len - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        off += (size_t)n;
+    }
+    return 1;
+}
+
+// Reads one reply into res. buf must hold PROTO_MAX_FRAME bytes.
+static int recv_frame(int sock, uint8_t* buf, Response* res, uint32_t* id) {
+    FrameHeader hdr;
+    memset(res, 0, sizeof(Response));
+    if (!read_full(sock, buf, PROTO_HEADER_SIZE_V1)) return 0;
+    int r = proto_parse_header(buf, PROTO_HEADER_SIZE_V1, &hdr);
+    if (r == 0) {
+        if (!read_full(sock, buf + PROTO_HEADER_SIZE_V1, hdr.size - PROTO_HEADER_SIZE_V1)) return 0;
+        r = proto_parse_header(buf, hdr.size, &hdr);
+    }
+    if (r != 1 || !read_full(sock, buf + hdr.size, hdr.length)) return 0;
+    if (!proto_decode_response(&hdr, buf + hdr.size, res)) return 0;
+    *id = hdr.request_id;
+    return 1;
+}
+
+static int call(int sock, uint8_t* buf, const Request* req, Response* res) {
+    uint32_t id;
+    return send_frame(sock, req, 1) && recv_frame(sock, buf, res, &id);
+}
+
+static int login(BenchConn* bc, int user_id, UserRole role) {
+    Request req; Response res;
+    memset(&req, 0, sizeof(req));
+    req.op = LOGIN;
+    req.intended_role = role;
+    snprintf(req.username, sizeof(req.username), "%d", user_id);
+    snprintf(req.password, sizeof(req.password), "%s", cfg_password);
+    if (!call(bc->sock, bc->rbuf, &req, &res)) return 0;
+    if (!res.success) fprintf(stderr, "Login %d: %s\n", user_id, res.message);
+    return res.success;
+}
+
+// Creates one customer per connection through the employee account.
+static int create_customers(BenchConn* conns) {
+    BenchConn* admin = &conns[0];
+    if ((admin->sock = connect_server()) == -1 || !login(admin, cfg_employee, EMPLOYEE)) return 0;
+    for (int i = 0; i < cfg_conns; i++) {
+        Request req; Response res;
+        memset(&req, 0, sizeof(req));
+        req.op = EMP_ADD_CUSTOMER;
+        snprintf(req.data.user_data.name, sizeof(req.data.user_data.name), "bench %d", i);
+        snprintf(req.data.user_data.password, sizeof(req.data.user_data.password), "%s", cfg_password);
+        if (!call(admin->sock, admin->rbuf, &req, &res) || !res.success ||
+            sscanf(res.message, "Customer created. ID: %d", &conns[i].customer_id) != 1) {
+            fprintf(stderr, "Creating customer %d failed: %s\n", i, res.message);
+            return 0;
+        }
+    }
+    close(admin->sock);
+    return 1;
+}
+
+static Operation pick_op(unsigned* seed) {
+    if (strcmp(cfg_mix, "deposit") == 0) return CUST_DEPOSIT;
+    if (strcmp(cfg_mix, "transfer") == 0) return CUST_TRANSFER;
+    if (strcmp(cfg_mix, "history") == 0) return CUST_VIEW_HISTORY;
+    if (strcmp(cfg_mix, "mixed") == 0) {
+        int r = (int)(rand_r(seed) % 100);
+        if (r < 60) return CUST_VIEW_BALANCE;
+        if (r < 80) return CUST_DEPOSIT;
+        if (r < 95) return CUST_TRANSFER;
+        return CUST_VIEW_HISTORY;
+    }
+    return CUST_VIEW_BALANCE;
+}
+
+static void* run_conn(void* arg) {
+    BenchConn* bc = (BenchConn*)arg;
+    uint64_t* sent_at = (uint64_t*)calloc((size_t)cfg_pipeline, sizeof(uint64_t));
+    unsigned seed = (unsigned)bc->customer_id;
+    uint32_t next_id = 1;
+    int inflight = 0;
+
+    pthread_barrier_wait(&start_barrier);
+    while (running || inflight > 0) {
+        while (running && inflight < cfg_pipeline) {
+            Request req;
+            memset(&req, 0, sizeof(req));
+            req.op = pick_op(&seed);
+            req.data.amount = 1.0;
+            if (req.op == CUST_TRANSFER) {
+                req.data.transfer.to_account_id = bc->peer_id;
+                req.data.transfer.amount = 1.0;
+            }
+            sent_at[next_id % (uint32_t)cfg_pipeline] = now_ns();
+            if (!send_frame(bc->sock, &req, next_id++)) { bc->errors++; goto out; }
+            inflight++;
+        }
+
+        Response res;
+        uint32_t id;
+        if (!recv_frame(bc->sock, bc->rbuf, &res, &id)) { bc->errors++; break; }
+        inflight--;
+        if (!res.success) bc->errors++;
+        if (bc->count == bc->cap) {
+            bc->cap = bc->cap ? bc->cap * 2 : 65536;
+            bc->latencies = (uint64_t*)realloc(bc->latencies, bc->cap * sizeof(uint64_t));
+        }
+        bc->latencies[bc->count++] = now_ns() - sent_at[id % (uint32_t)cfg_pipeline];
+    }
+out:
+    free(sent_at);
+    return NULL;
+}
+
+static int fetch_stats(Response* res) {
+    BenchConn* probe = (BenchConn*)malloc(sizeof(BenchConn));
+    Request req;
+    memset(&req, 0, sizeof(req));
+    req.op = SERVER_STATS;
+    int ok = probe && (probe->sock = connect_server()) != -1 && call(probe->sock, probe->rbuf, &req, res);
+    if (probe && probe->sock != -1) close(probe->sock);
+    free(probe);
+    return ok;
+}
+
+static const OpStats* find_op(const Response* res, int op) {
+    for (int i = 0; i < res->data.op_stats.count; i++) {
+        if (res->data.op_stats.ops[i].op == op) return &res->data.op_stats.ops[i];
+    }
+    return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-c conns] [-d seconds] [-m balance|deposit|transfer|history|mixed]\n"
+                    "          [-u first_customer_id] [-p password] [-P pipeline] [-E employee_id] [-h host]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:m:u:p:P:E:h:")) != -1) {
+        switch (opt) {
+            case 'c': cfg_conns = atoi(optarg); break;
+            case 'd': cfg_seconds = atoi(optarg); break;
+            case 'm': cfg_mix = optarg; break;
+            case 'u': cfg_first_id = atoi(optarg); break;
+            case 'p': cfg_password = optarg; break;
+            case 'P': cfg_pipeline = atoi(optarg); break;
+            case 'E': cfg_employee = atoi(optarg); break;
+            case 'h': cfg_host = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (cfg_conns <= 0 || cfg_seconds <= 0 || cfg_pipeline <= 0) usage(argv[0]);
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchConn* conns = (BenchConn*)calloc((size_t)cfg_conns, sizeof(BenchConn));
+    if (!conns) { perror("calloc"); return 1; }
+    if (cfg_employee) {
+        if (!create_customers(conns)) return 1;
+    } else {
+        for (int i = 0; i < cfg_conns; i++) conns[i].customer_id = cfg_first_id + i;
+    }
+    for (int i = 0; i < cfg_conns; i++) {
+        conns[i].peer_id = conns[(i + 1) % cfg_conns].customer_id;
+        if ((conns[i].sock = connect_server()) == -1 || !login(&conns[i], conns[i].customer_id, CUSTOMER)) return 1;
+    }
+
+    Response before, after;
+    if (!fetch_stats(&before)) { fprintf(stderr, "SERVER_STATS failed\n"); return 1; }
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)cfg_conns + 1);
+    for (int i = 0; i < cfg_conns; i++) pthread_create(&conns[i].tid, NULL, run_conn, &conns[i]);
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    sleep((unsigned)cfg_seconds);
+    running = 0;
+    for (int i = 0; i < cfg_conns; i++) pthread_join(conns[i].tid, NULL);
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    if (!fetch_stats(&after)) { fprintf(stderr, "SERVER_STATS failed\n"); return 1; }
+
+    size_t total = 0;
+    unsigned long errors = 0;
+    for (int i = 0; i < cfg_conns; i++) { total += conns[i].count; errors += conns[i].errors; }
+    uint64_t* all = (uint64_t*)malloc((total ? total : 1) * sizeof(uint64_t));
+    size_t n = 0;
+    for (int i = 0; i < cfg_conns; i++) {
+        memcpy(all + n, conns[i].latencies, conns[i].count * sizeof(uint64_t));
+        n += conns[i].count;
+    }
+    qsort(all, total, sizeof(uint64_t), compare_u64);
+
+    printf("mix %s, %d connection(s), pipeline %d, %.1f s\n", cfg_mix, cfg_conns, cfg_pipeline, elapsed);
+    printf("server: %s\n", after.message);
+    printf("requests %zu, errors %lu, %.0f req/s\n", total, errors, (double)total / elapsed);
+    if (total > 0) {
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               (double)all[total / 2] / 1e3, (double)all[total * 9 / 10] / 1e3,
+               (double)all[total * 99 / 100] / 1e3, (double)all[total - 1] / 1e3);
+    }
+
+    printf("%-6s %10s %16s %12s\n", "op", "requests", "syscalls/req", "us/req");
+    for (int i = 0; i < after.data.op_stats.count; i++) {
+        const OpStats* a = &after.data.op_stats.ops[i];
+        const OpStats* b = find_op(&before, a->op);
+        unsigned long long reqs = a->requests - (b ? b->requests : 0);
+        if (reqs == 0 || a->op == SERVER_STATS) continue;
+        printf("%-6d %10llu %16.2f %12.1f\n", a->op, reqs,
+               (double)(a->db_syscalls - (b ? b->db_syscalls : 0)) / (double)reqs,
+               (double)(a->busy_us - (b ? b->busy_us : 0)) / (double)reqs);
+    }
+
+    for (int i = 0; i < cfg_conns; i++) { close(conns[i].sock); free(conns[i].latencies); }
+    free(conns); free(all);
+    return 0;
+}
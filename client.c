@@ -1,5 +1,7 @@
 #include "common.h"
+#include "proto.h"
 #include <time.h> // Needed for ctime_r
+#include <float.h>
 
 // --- Function Prototypes ---
 void handle_login_flow(int sock);
@@ -17,12 +19,14 @@ void transfer_funds(int sock);
 void view_transaction_history(int sock);
 void apply_for_loan(int sock);
 void add_feedback(int sock);
+void submit_batch(int sock);
 
 // Employee
 void show_employee_menu(int sock);
 void add_new_customer(int sock);
 void emp_modify_customer(int sock);
 void emp_view_customer_tx(int sock);
+void emp_view_tx_range(int sock);
 void employee_process_loan(int sock); 
 
 // Manager
@@ -32,6 +36,8 @@ void mgr_view_pending_loans(int sock);
 void mgr_assign_loan(int sock);
 void mgr_review_feedback(int sock);
 void mgr_view_user_list(int sock); 
+void mgr_audit_tx_range(int sock);
+void mgr_query_transactions(int sock);
 
 // Admin
 void show_admin_menu(int sock);
@@ -39,9 +45,21 @@ void admin_add_user(int sock);
 void admin_mod_user(int sock);
 void admin_view_user_list(int sock); 
 
+// Wire protocol
+int send_request(int sock, Request* req, uint32_t request_id);
+int recv_response(int sock, Response* res, uint32_t* request_id);
+int transact(int sock, Request* req, Response* res);
+int transact_many(int sock, Request* reqs, Response* res, int n);
+int fetch_page(int sock, Operation list_op, int target, uint64_t* cursor, int limit, Response* res);
+int more_pages(void);
+
 // Helpers
 void display_tx_history(Response* res);
+void display_transactions(const Transaction* txs, int n);
 void display_user_details(User* user); 
+void page_user_list(int sock, Operation list_op, UserRole role);
+int read_time_range(time_t* from, time_t* to);
+void page_tx_range(int sock, Operation list_op, int target, time_t from, time_t to);
 
 
 // --- Helper function to clear stdin buffer ---
@@ -50,6 +68,105 @@ void clear_stdin_buffer() {
     while ((c = getchar()) != '\n' && c != EOF);
 }
 
+// --- Wire Protocol Helpers ---
+// Requests and replies travel as length-prefixed frames (see proto.h). Every
+// request carries an ID that the server echoes, so several requests can be in
+// flight at once. Each helper returns 0 if the connection to the server is lost.
+static uint32_t next_request_id = 1;
+
+static int write_full(int sock, const void* buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(sock, (const char*)buf + off, len - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        off += (size_t)n;
+    }
+    return 1;
+}
+
+static int read_full(int sock, void* buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = read(sock, (char*)buf + off, len - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        off += (size_t)n;
+    }
+    return 1;
+}
+
+int send_request(int sock, Request* req, uint32_t request_id) {
+    uint8_t frame[PROTO_MAX_FRAME];
+    size_t len = proto_encode_request(req, request_id, frame, sizeof(frame));
+    return len > 0 && write_full(sock, frame, len);
+}
+
+int recv_response(int sock, Response* res, uint32_t* request_id) {
+    static uint8_t payload[PROTO_MAX_PAYLOAD];
+    uint8_t header[PROTO_HEADER_SIZE];
+    FrameHeader hdr;
+    memset(res, 0, sizeof(Response));
+    if (!read_full(sock, header, PROTO_HEADER_SIZE_V1)) return 0;
+    int r = proto_parse_header(header, PROTO_HEADER_SIZE_V1, &hdr);
+    if (r == 0) {
+        if (!read_full(sock, header + PROTO_HEADER_SIZE_V1, hdr.size - PROTO_HEADER_SIZE_V1)) return 0;
+        r = proto_parse_header(header, hdr.size, &hdr);
+    }
+    if (r != 1 || !read_full(sock, payload, hdr.length)) return 0;
+    if (!proto_decode_response(&hdr, payload, res)) {
+        res->success = 0; strcpy(res->message, "Malformed reply from server.");
+    }
+    if (request_id) *request_id = hdr.request_id;
+    return 1;
+}
+
+int transact(int sock, Request* req, Response* res) {
+    return transact_many(sock, req, res, 1);
+}
+
+// Sends n requests back to back, then collects the n replies in whatever
+// order the server finishes them; res[i] answers reqs[i].
+int transact_many(int sock, Request* reqs, Response* res, int n) {
+    uint32_t first_id = next_request_id;
+    next_request_id += (uint32_t)n;
+    for (int i = 0; i < n; i++) {
+        if (!send_request(sock, &reqs[i], first_id + (uint32_t)i)) return 0;
+    }
+    for (int received = 0; received < n; received++) {
+        Response reply;
+        uint32_t id;
+        if (!recv_response(sock, &reply, &id)) return 0;
+        if (id - first_id >= (uint32_t)n) { received--; continue; } // Not ours; ignore
+        res[id - first_id] = reply;
+    }
+    return 1;
+}
+
+// Fetches the page of a listing that starts at *cursor (0 for the first) and
+// advances *cursor to the next one; it is 0 once the last page has arrived.
+// The caller frees the rows with proto_release_response.
+int fetch_page(int sock, Operation list_op, int target, uint64_t* cursor, int limit, Response* res) {
+    Request req;
+    memset(&req, 0, sizeof(req));
+    req.op = LIST_PAGE;
+    req.data.page.list_op = list_op;
+    req.data.page.target = target;
+    req.data.page.cursor = *cursor;
+    req.data.page.limit = limit;
+    if (!transact(sock, &req, res)) return 0;
+    *cursor = res->success ? res->data.page.next_cursor : 0;
+    return 1;
+}
+
+// Asks whether to show the next page.
+int more_pages(void) {
+    printf("Press Enter for the next page, or q then Enter to stop: ");
+    int c = getchar();
+    if (c != '\n' && c != EOF) clear_stdin_buffer();
+    return c != 'q' && c != 'Q' && c != EOF;
+}
+
 // --- Main ---
 int main() {
     int sock = 0;
@@ -133,10 +250,7 @@ void handle_login_flow(int sock) {
         scanf("%99s", req.password);
         clear_stdin_buffer(); 
         
-        if (write(sock, &req, sizeof(Request)) <= 0) {
-            printf("Connection lost to server.\n"); return;
-        }
-        if (read(sock, &res, sizeof(Response)) <= 0) {
+        if (!transact(sock, &req, &res)) {
             printf("Connection lost to server.\n"); return;
         }
         
@@ -170,7 +284,7 @@ void handle_login_flow(int sock) {
         }
     }
     req.op = EXIT;
-    write(sock, &req, sizeof(Request));
+    send_request(sock, &req, next_request_id++);
 }
 
 // =================================================
@@ -186,8 +300,7 @@ void change_password(int sock) {
     scanf("%99s", req.data.new_password);
     clear_stdin_buffer();
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
@@ -206,7 +319,8 @@ void show_customer_menu(int sock) {
         printf("6. Apply for Loan\n");
         printf("7. Add Feedback\n");
         printf("8. Change Password\n");
-        printf("9. Logout\n");
+        printf("9. Submit Batch (from file)\n");
+        printf("10. Logout\n");
         printf("Enter your choice: ");
         
         if (scanf("%d", &choice) != 1) {
@@ -225,7 +339,8 @@ void show_customer_menu(int sock) {
             case 6: apply_for_loan(sock); break;
             case 7: add_feedback(sock); break;
             case 8: change_password(sock); break;
-            case 9: return; // Logout
+            case 9: submit_batch(sock); break;
+            case 10: return; // Logout
             default: printf("Invalid choice.\n");
         }
     }
@@ -235,8 +350,7 @@ void view_balance(int sock) {
     Request req; Response res;
     memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
     req.op = CUST_VIEW_BALANCE;
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
@@ -258,8 +372,7 @@ void deposit_money(int sock) {
         return;
     }
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
@@ -281,8 +394,7 @@ void withdraw_money(int sock) {
         return;
     }
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
@@ -312,23 +424,24 @@ void transfer_funds(int sock) {
         return;
     }
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
 void view_transaction_history(int sock) {
-    Request req; Response res;
-    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
-    req.op = CUST_VIEW_HISTORY;
+    // History and current balance are fetched together in one round trip.
+    Request req[2]; Response res[2];
+    memset(req, 0, sizeof(req)); memset(res, 0, sizeof(res));
+    req[0].op = CUST_VIEW_HISTORY;
+    req[1].op = CUST_VIEW_BALANCE;
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact_many(sock, req, res, 2);
     
-    printf("SERVER: %s\n", res.message);
-    if(res.success && res.data.tx_history.history_count > 0) {
-        display_tx_history(&res);
+    printf("SERVER: %s\n", res[0].message);
+    if(res[0].success && res[0].data.tx_history.history_count > 0) {
+        display_tx_history(&res[0]);
     }
+    if (res[1].success) printf("Current balance: $%.2f\n", res[1].data.balance);
 }
 
 void apply_for_loan(int sock) {
@@ -344,8 +457,7 @@ void apply_for_loan(int sock) {
     }
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 void add_feedback(int sock) {
@@ -357,11 +469,77 @@ void add_feedback(int sock) {
     scanf(" %511[^\n]", req.data.feedback_message); 
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
+// Sends every line of a file as one CUST_BATCH request. Lines look like
+// "DEPOSIT <amount>", "WITHDRAW <amount>" or "TRANSFER <to_id> <amount>".
+void submit_batch(int sock) {
+    static const char* status_text[] = {
+        "OK", "Invalid operation", "Invalid amount", "Invalid account",
+        "Recipient deactivated", "Insufficient funds"
+    };
+    char path[256], line[128], word[16];
+    printf("Enter batch file path: ");
+    scanf("%255s", path);
+    clear_stdin_buffer();
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) { perror("fopen"); return; }
+
+    BatchItem* items = (BatchItem*)calloc(MAX_BATCH_ITEMS, sizeof(BatchItem));
+    if (!items) { fclose(fp); return; }
+    int count = 0, line_no = 0;
+    while (count < MAX_BATCH_ITEMS && fgets(line, sizeof(line), fp)) {
+        BatchItem* item = &items[count];
+        line_no++;
+        if (sscanf(line, "%15s", word) != 1) continue; // Blank line
+        if (strcmp(word, "DEPOSIT") == 0 && sscanf(line, "%*s %lf", &item->amount) == 1) {
+            item->op = CUST_DEPOSIT;
+        } else if (strcmp(word, "WITHDRAW") == 0 && sscanf(line, "%*s %lf", &item->amount) == 1) {
+            item->op = CUST_WITHDRAW;
+        } else if (strcmp(word, "TRANSFER") == 0 &&
+                   sscanf(line, "%*s %d %lf", &item->to_account_id, &item->amount) == 2) {
+            item->op = CUST_TRANSFER;
+        } else {
+            printf("Skipping line %d: %s", line_no, line);
+            continue;
+        }
+        count++;
+    }
+    fclose(fp);
+    if (count == 0) { printf("No operations found in %s.\n", path); free(items); return; }
+
+    Request req; Response res;
+    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
+    req.op = CUST_BATCH;
+    req.data.batch.count = count;
+    req.data.batch.items = items;
+
+    if (!transact(sock, &req, &res)) { printf("Connection lost to server.\n"); free(items); return; }
+    printf("SERVER: %s\n", res.message);
+    if (res.success) {
+        printf("%-4s | %-10s | %-8s | %-10s | %s\n", "#", "Operation", "To", "Amount", "Result");
+        printf("------------------------------------------------------------------\n");
+        for (int i = 0; i < res.data.batch.count && i < count; i++) {
+            BatchResult* r = &res.data.batch.results[i];
+            const char* op = items[i].op == CUST_DEPOSIT ? "DEPOSIT" :
+                             items[i].op == CUST_WITHDRAW ? "WITHDRAW" : "TRANSFER";
+            const char* text = (r->status <= BATCH_INSUFFICIENT_FUNDS) ? status_text[r->status] : "Unknown";
+            if (items[i].op == CUST_TRANSFER) {
+                printf("%-4d | %-10s | %-8d | $%-9.2f | %s", i + 1, op, items[i].to_account_id, items[i].amount, text);
+            } else {
+                printf("%-4d | %-10s | %-8s | $%-9.2f | %s", i + 1, op, "-", items[i].amount, text);
+            }
+            if (r->status == BATCH_OK) printf(" (balance $%.2f)", r->new_balance);
+            printf("\n");
+        }
+    }
+    proto_release_response(CUST_BATCH, &res);
+    free(items);
+}
+
 
 // =================================================
 // ---            EMPLOYEE SECTION             ---
@@ -373,9 +551,10 @@ void show_employee_menu(int sock) {
         printf("1. Add New Customer\n");
         printf("2. Modify Customer Details\n");
         printf("3. View Customer Transactions (Passbook)\n");
-        printf("4. View & Process Assigned Loans\n"); 
-        printf("5. Change Password\n");
-        printf("6. Logout\n");
+        printf("4. View Customer Transactions Between Dates\n");
+        printf("5. View & Process Assigned Loans\n"); 
+        printf("6. Change Password\n");
+        printf("7. Logout\n");
         printf("Enter your choice: "); 
         
         if (scanf("%d", &choice) != 1) {
@@ -389,9 +568,10 @@ void show_employee_menu(int sock) {
             case 1: add_new_customer(sock); break;
             case 2: emp_modify_customer(sock); break;
             case 3: emp_view_customer_tx(sock); break;
-            case 4: employee_process_loan(sock); break; 
-            case 5: change_password(sock); break;
-            case 6: return; // Logout
+            case 4: emp_view_tx_range(sock); break;
+            case 5: employee_process_loan(sock); break; 
+            case 6: change_password(sock); break;
+            case 7: return; // Logout
             default: printf("Invalid choice.\n");
         }
     }
@@ -409,8 +589,7 @@ void add_new_customer(int sock) {
     scanf("%99s", req.data.user_data.password);
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
@@ -431,31 +610,59 @@ void emp_modify_customer(int sock) {
     scanf(" %99[^\n]", req.data.user_data.name);
     clear_stdin_buffer();
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
+// Shows the customer's whole history. It is streamed: one request, and the
+// server sends page after page until the oldest transaction.
 void emp_view_customer_tx(int sock) {
     Request req; Response res;
-    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
-    req.op = EMP_VIEW_CUST_TX;
+    memset(&req, 0, sizeof(req));
+    req.op = LIST_PAGE;
+    req.data.page.list_op = EMP_VIEW_CUST_TX;
+    req.data.page.limit = MAX_PAGE_ROWS;
+    req.data.page.stream = 1;
     
     printf("Enter Customer ID to view transactions: ");
-    if (scanf("%d", &req.data.target_user_id) != 1) {
+    if (scanf("%d", &req.data.page.target) != 1) {
          printf("Invalid input. Please enter a number.\n");
          clear_stdin_buffer();
          return; 
     }
     clear_stdin_buffer();
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
-    
-    printf("SERVER: %s\n", res.message);
-    if(res.success && res.data.tx_history.history_count > 0) {
-        display_tx_history(&res);
+    uint32_t id = next_request_id++;
+    if (!send_request(sock, &req, id)) { printf("Server disconnected.\n"); return; }
+    printf("--- Transaction History ---\n");
+    int total = 0;
+    while (1) {
+        uint32_t reply_id;
+        if (!recv_response(sock, &res, &reply_id)) { printf("Server disconnected.\n"); return; }
+        if (reply_id != id) continue; // Not ours; ignore
+        if (!res.success) { printf("SERVER: %s\n", res.message); break; }
+        display_transactions(res.data.page.rows.txs, res.data.page.count);
+        total += res.data.page.count;
+        uint64_t next = res.data.page.next_cursor;
+        proto_release_response(LIST_PAGE, &res);
+        if (next == 0) break;
     }
+    printf("%d transaction(s).\n", total);
+}
+
+// One customer's transactions between two dates, newest first.
+void emp_view_tx_range(int sock) {
+    int target;
+    time_t from, to;
+    printf("Enter Customer ID to view transactions: ");
+    if (scanf("%d", &target) != 1) {
+         printf("Invalid input. Please enter a number.\n");
+         clear_stdin_buffer();
+         return; 
+    }
+    clear_stdin_buffer();
+    if (!read_time_range(&from, &to)) return;
+    page_tx_range(sock, EMP_VIEW_TX_RANGE, target, from, to);
 }
 
 void employee_process_loan(int sock) {
@@ -466,8 +673,7 @@ void employee_process_loan(int sock) {
     memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
     req.op = EMP_VIEW_ASSIGNED_LOANS; 
     
-    write(sock, &req, sizeof(Request));
-    if(read(sock, &res, sizeof(Response)) <= 0) {
+    if(!transact(sock, &req, &res)) {
         printf("Server disconnected.\n"); return;
     }
     
@@ -516,8 +722,7 @@ void employee_process_loan(int sock) {
     
     req.data.loan_action.approve = action;
     
-    write(sock, &req, sizeof(Request));
-    if(read(sock, &res, sizeof(Response)) <= 0) {
+    if(!transact(sock, &req, &res)) {
          printf("Server disconnected.\n"); return;
     }
     printf("SERVER: %s\n", res.message);
@@ -537,8 +742,10 @@ void show_manager_menu(int sock) {
         printf("4. Assign Loan to Employee\n");
         printf("5. Review Customer Feedback\n");
         printf("6. View User Details\n"); 
-        printf("7. Change Password\n");
-        printf("8. Logout\n");
+        printf("7. Audit Transactions Between Dates\n");
+        printf("8. Analyze Transactions\n");
+        printf("9. Change Password\n");
+        printf("10. Logout\n");
         printf("Enter your choice: "); 
         
         if (scanf("%d", &choice) != 1) {
@@ -555,8 +762,10 @@ void show_manager_menu(int sock) {
             case 4: mgr_assign_loan(sock); break;
             case 5: mgr_review_feedback(sock); break;
             case 6: mgr_view_user_list(sock); break; 
-            case 7: change_password(sock); break;
-            case 8: return; // Logout
+            case 7: mgr_audit_tx_range(sock); break;
+            case 8: mgr_query_transactions(sock); break;
+            case 9: change_password(sock); break;
+            case 10: return; // Logout
             default: printf("Invalid choice.\n");
         }
     }
@@ -574,30 +783,27 @@ void mgr_toggle_account(int sock, Operation op) {
     }
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
 void mgr_view_pending_loans(int sock) {
-    Request req; Response res;
-    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
-    req.op = MGR_VIEW_PENDING_LOANS;
-    
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
-    
-    printf("SERVER: %s\n", res.message);
-    if (res.success && res.data.loan_list.loan_count > 0) {
-        printf("--- All Pending Loan Applications ---\n");
-        int max_to_show = (res.data.loan_list.loan_count > 20) ? 20 : res.data.loan_list.loan_count;
-        for (int i = 0; i < max_to_show; i++) {
-            Loan loan = res.data.loan_list.loans[i];
+    Response res;
+    uint64_t cursor = 0;
+    printf("--- All Pending Loan Applications ---\n");
+    do {
+        if (!fetch_page(sock, MGR_VIEW_PENDING_LOANS, 0, &cursor, 20, &res)) {
+            printf("Server disconnected.\n"); return;
+        }
+        if (!res.success) { printf("SERVER: %s\n", res.message); return; }
+        for (int i = 0; i < res.data.page.count; i++) {
+            Loan loan = res.data.page.rows.loans[i];
             printf("  Loan ID: %d | Cust ID: %d | Amount: $%.2f | Assigned to: %d\n",
                    loan.loan_id, loan.customer_id, loan.amount, loan.assigned_to_employee_id);
         }
-        printf("-----------------------------------\n");
-    }
+        proto_release_response(LIST_PAGE, &res);
+    } while (cursor != 0 && more_pages());
+    printf("-----------------------------------\n");
 }
 
 void mgr_assign_loan(int sock) {
@@ -621,16 +827,14 @@ void mgr_assign_loan(int sock) {
     }
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 void mgr_review_feedback(int sock) {
     Request req; Response res;
     memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
     req.op = MGR_REVIEW_FEEDBACK;
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
     if (res.success && res.data.feedback.count > 0) {
         printf("--- Displaying %d Feedback Entries ---\n", res.data.feedback.count);
@@ -647,11 +851,77 @@ void mgr_review_feedback(int sock) {
     }
 }
 
-void mgr_view_user_list(int sock) { 
+// Every transaction in the bank between two dates, oldest first.
+void mgr_audit_tx_range(int sock) {
+    time_t from, to;
+    if (!read_time_range(&from, &to)) return;
+    page_tx_range(sock, MGR_AUDIT_TX_RANGE, 0, from, to);
+}
+
+// Totals of the transactions that match a few filters, whole or per group.
+void mgr_query_transactions(int sock) {
+    static const char* type_names[TX_TYPE_COUNT] = { "OTHER", "DEPOSIT", "WITHDRAW", "TRANSFER_OUT", "TRANSFER_IN", "LOAN_DEPOSIT" };
+    static const char* group_names[] = { "All", "Day", "Type", "Account" };
     Request req; Response res;
+    memset(&req, 0, sizeof(req));
+    req.op = MGR_TX_QUERY;
+    TxQuery* q = &req.data.query;
+    int type, group;
+    double min_amount;
+
+    printf("Type (0 all, 1 DEPOSIT, 2 WITHDRAW, 3 TRANSFER_OUT, 4 TRANSFER_IN, 5 LOAN_DEPOSIT): ");
+    if (scanf("%d", &type) != 1 || type < 0 || type >= TX_TYPE_COUNT) {
+        printf("Invalid type.\n"); clear_stdin_buffer(); return;
+    }
+    clear_stdin_buffer();
+    printf("Account ID (0 for all): ");
+    if (scanf("%d", &q->account_id) != 1) {
+        printf("Invalid input. Please enter a number.\n"); clear_stdin_buffer(); return;
+    }
+    clear_stdin_buffer();
+    if (!read_time_range(&q->from, &q->to)) return;
+    printf("Minimum amount (0 for any): ");
+    if (scanf("%lf", &min_amount) != 1) {
+        printf("Invalid amount.\n"); clear_stdin_buffer(); return;
+    }
+    clear_stdin_buffer();
+    printf("Group by (0 none, 1 day, 2 type, 3 account): ");
+    if (scanf("%d", &group) != 1 || group < TX_GROUP_NONE || group > TX_GROUP_ACCOUNT) {
+        printf("Invalid choice.\n"); clear_stdin_buffer(); return;
+    }
+    clear_stdin_buffer();
+    q->types = type ? 1u << type : 0;
+    q->min_amount = min_amount > 0 ? min_amount : -DBL_MAX;
+    q->max_amount = DBL_MAX;
+    q->group_by = (TxGroupBy)group;
+    q->measure = TX_MEASURE_AMOUNT;
+
+    if (!transact(sock, &req, &res)) { printf("Server disconnected.\n"); return; }
+    printf("SERVER: %s\n", res.message);
+    if (!res.success) return;
+    printf("%-12s %10s %14s %12s %12s\n", group_names[group], "Count", "Total", "Smallest", "Largest");
+    for (int i = 0; i < res.data.query.count; i++) {
+        const TxQueryRow* row = &res.data.query.rows[i];
+        char key[32];
+        if (group == TX_GROUP_DAY) {
+            time_t day = (time_t)row->key * 86400;
+            struct tm tm;
+            strftime(key, sizeof(key), "%Y-%m-%d", gmtime_r(&day, &tm));
+        } else if (group == TX_GROUP_TYPE) {
+            snprintf(key, sizeof(key), "%s", row->key >= 0 && row->key < TX_TYPE_COUNT ? type_names[row->key] : "?");
+        } else if (group == TX_GROUP_ACCOUNT) {
+            snprintf(key, sizeof(key), "%lld", (long long)row->key);
+        } else {
+            strcpy(key, "-");
+        }
+        printf("%-12s %10llu %14.2f %12.2f %12.2f\n", key, (unsigned long long)row->count, row->sum, row->min, row->max);
+    }
+    if (res.data.query.truncated) printf("(More than %d groups matched; the rest are left out.)\n", MAX_QUERY_GROUPS);
+    proto_release_response(MGR_TX_QUERY, &res);
+}
+
+void mgr_view_user_list(int sock) { 
     int choice;
-    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
-    req.op = MGR_VIEW_USER_LIST;
 
     printf("\n--- View User Details ---\n");
     printf("1. Customer\n");
@@ -666,19 +936,7 @@ void mgr_view_user_list(int sock) {
     }
     clear_stdin_buffer();
     
-    req.data.user_data.role = (UserRole)choice;
-    
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
-    
-    printf("SERVER: %s\n", res.message);
-    if (res.success && res.data.user_list.count > 0) {
-        printf("--- Displaying %d User(s) ---\n", res.data.user_list.count);
-        int max_to_show = (res.data.user_list.count > MAX_USER_LIST) ? MAX_USER_LIST : res.data.user_list.count;
-        for (int i = 0; i < max_to_show; i++) {
-            display_user_details(&res.data.user_list.list[i]);
-        }
-    }
+    page_user_list(sock, MGR_VIEW_USER_LIST, (UserRole)choice);
 }
 
 // =================================================
@@ -739,8 +997,7 @@ void admin_add_user(int sock) {
     scanf("%99s", req.data.user_data.password);
     clear_stdin_buffer(); 
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 void admin_mod_user(int sock) {
@@ -783,16 +1040,12 @@ void admin_mod_user(int sock) {
     clear_stdin_buffer(); 
     req.data.user_data.isActive = active_choice;
     
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
+    transact(sock, &req, &res);
     printf("SERVER: %s\n", res.message);
 }
 
 void admin_view_user_list(int sock) {
-    Request req; Response res;
     int choice;
-    memset(&req, 0, sizeof(req)); memset(&res, 0, sizeof(res));
-    req.op = ADMIN_VIEW_USER_LIST;
 
     printf("\n--- View User Details ---\n");
     printf("1. Customer\n");
@@ -808,27 +1061,19 @@ void admin_view_user_list(int sock) {
     }
     clear_stdin_buffer();
     
-    req.data.user_data.role = (UserRole)choice;
-    
-    write(sock, &req, sizeof(Request));
-    read(sock, &res, sizeof(Response));
-    
-    printf("SERVER: %s\n", res.message);
-    if (res.success && res.data.user_list.count > 0) {
-        printf("--- Displaying %d User(s) ---\n", res.data.user_list.count);
-        int max_to_show = (res.data.user_list.count > MAX_USER_LIST) ? MAX_USER_LIST : res.data.user_list.count;
-        for (int i = 0; i < max_to_show; i++) {
-            display_user_details(&res.data.user_list.list[i]);
-        }
-    }
+    page_user_list(sock, ADMIN_VIEW_USER_LIST, (UserRole)choice);
 }
 
 
 // --- HELPER to display transaction history ---
 void display_tx_history(Response* res) {
     printf("--- Transaction History ---\n");
-    for (int i = 0; i < res->data.tx_history.history_count; i++) {
-        Transaction tx = res->data.tx_history.history[i];
+    display_transactions(res->data.tx_history.history, res->data.tx_history.history_count);
+}
+
+void display_transactions(const Transaction* txs, int n) {
+    for (int i = 0; i < n; i++) {
+        Transaction tx = txs[i];
         
         char time_str[26];
         ctime_r(&tx.timestamp, time_str);
@@ -841,6 +1086,57 @@ void display_tx_history(Response* res) {
     }
 }
 
+// Asks for two dates and returns local midnight of the first and the last
+// second of the second.
+int read_time_range(time_t* from, time_t* to) {
+    struct tm day[2];
+    const char* prompts[2] = { "From date (YYYY-MM-DD): ", "To date (YYYY-MM-DD): " };
+    for (int i = 0; i < 2; i++) {
+        memset(&day[i], 0, sizeof(day[i]));
+        printf("%s", prompts[i]);
+        if (scanf("%d-%d-%d", &day[i].tm_year, &day[i].tm_mon, &day[i].tm_mday) != 3) {
+            printf("Invalid date.\n");
+            clear_stdin_buffer();
+            return 0;
+        }
+        clear_stdin_buffer();
+        day[i].tm_year -= 1900; day[i].tm_mon -= 1; day[i].tm_isdst = -1;
+    }
+    day[1].tm_hour = 23; day[1].tm_min = 59; day[1].tm_sec = 59;
+    *from = mktime(&day[0]);
+    *to = mktime(&day[1]);
+    if (*from == (time_t)-1 || *to == (time_t)-1) { printf("Invalid date.\n"); return 0; }
+    return 1;
+}
+
+// Pages through a time-range listing, showing the account of each row.
+void page_tx_range(int sock, Operation list_op, int target, time_t from, time_t to) {
+    Request req; Response res;
+    uint64_t cursor = 0;
+    int total = 0;
+    printf("--- Transactions ---\n");
+    do {
+        memset(&req, 0, sizeof(req));
+        req.op = LIST_PAGE;
+        req.data.page.list_op = list_op;
+        req.data.page.target = target;
+        req.data.page.cursor = cursor;
+        req.data.page.limit = 20;
+        req.data.page.from = from;
+        req.data.page.to = to;
+        if (!transact(sock, &req, &res)) { printf("Server disconnected.\n"); return; }
+        if (!res.success) { printf("SERVER: %s\n", res.message); return; }
+        for (int i = 0; i < res.data.page.count; i++) {
+            printf("  Account: %d\n", res.data.page.rows.txs[i].account_id);
+            display_transactions(&res.data.page.rows.txs[i], 1);
+        }
+        total += res.data.page.count;
+        cursor = res.data.page.next_cursor;
+        proto_release_response(LIST_PAGE, &res);
+    } while (cursor != 0 && more_pages());
+    printf("%d transaction(s).\n", total);
+}
+
 // --- HELPER to display user details ---
 void display_user_details(User* user) {
     printf("  --- User Details ---\n");
@@ -858,4 +1154,21 @@ void display_user_details(User* user) {
     printf("  Role:   %s\n", role_str);
     printf("  Status: %s\n", user->isActive ? "Active" : "Deactivated");
     printf("  --------------------\n");
+}
+
+// --- HELPER to page through a user list ---
+void page_user_list(int sock, Operation list_op, UserRole role) {
+    Response res;
+    uint64_t cursor = 0;
+    int shown = 0;
+    do {
+        if (!fetch_page(sock, list_op, role, &cursor, MAX_USER_LIST, &res)) {
+            printf("Server disconnected.\n"); return;
+        }
+        if (!res.success) { printf("SERVER: %s\n", res.message); return; }
+        for (int i = 0; i < res.data.page.count; i++) display_user_details(&res.data.page.rows.users[i]);
+        shown += res.data.page.count;
+        proto_release_response(LIST_PAGE, &res);
+    } while (cursor != 0 && more_pages());
+    printf("Displayed %d user(s).\n", shown);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>     // For system calls: read, write, open, close, lseek, fcntl
 #include <sys/socket.h> // For socket programming
@@ -15,16 +16,29 @@
 #include <time.h>       // For transactions
 
 #define SERVER_PORT 8080
-#define MAX_CLIENTS 20
+#define MAX_CLIENTS 20 // Default listen() backlog; override with server -b
 #define MAX_TRANSACTIONS 50 
 #define MAX_USER_LIST 50 // Max users to send in one list
+#define MAX_BATCH_ITEMS 4096 // Max operations in one CUST_BATCH request
+#define MAX_OP_STATS 64 // Operation codes are all below this
+#define MAX_PAGE_ROWS 100 // Max rows in one LIST_PAGE reply
+#define MAX_QUERY_GROUPS 1000 // Max rows in one MGR_TX_QUERY reply
 
 // --- Database File Names ---
 #define USER_FILE "db_users.dat"
 #define ACCOUNT_FILE "db_accounts.dat"
-#define TRANSACTION_FILE "db_transactions.dat"
+#define TRANSACTION_FILE "db_transactions.dat" // single-file log of older versions; split into segments at startup
+#define TXMANIFEST_FILE "db_txmanifest.dat"
+#define TXSEGMENT_FILE "db_txseg_%06u.dat"      // printf format; takes the segment number
+#define TXARCHIVE_DIR "db_archive"              // where archived segments are moved
+#define TXPACK_FILE "db_txseg_%06u.pack"        // an archived segment, packed; in TXARCHIVE_DIR
 #define LOAN_FILE "db_loans.dat"
 #define FEEDBACK_FILE "db_feedback.dat" 
+#define WAL_FILE "db_wal.dat"
+#define TXINDEX_FILE "db_txindex.dat"
+#define USERID_FILE "db_userids.dat"
+#define TXHEADS_FILE "db_txheads.dat"
+#define LOCK_FILE "db_owner.lock" // flock'd by every server; exclusively with -X
 
 // --- Role Definitions ---
 typedef enum {
@@ -36,6 +50,44 @@ typedef enum {
 
 // --- Data Structures ---
 
+// USER_FILE and ACCOUNT_FILE are keyed files: slot 0 (one record's worth of
+// bytes) starts with this header, and the records follow in the order they
+// were created. The server finds them by ID through an index it builds at
+// startup, so IDs are not tied to file offsets.
+#define KEYED_FILE_MAGIC 0x3159454bu // "KEY1"
+typedef struct {
+    uint32_t magic;
+    uint32_t record_size;
+} KeyedFileHeader;
+
+// The transaction log is a run of segment files of records_per_segment
+// records each: segment n holds IDs n * records_per_segment + 1 onwards, at
+// offset (ID - 1) % records_per_segment, so IDs never change when old
+// segments are archived. Segments before tail are full, synced and read-only.
+// TXMANIFEST_FILE holds this header and is replaced whole (write, then rename).
+#define TXMANIFEST_MAGIC 0x3147534du  // "MSG1"
+#define TXSEGMENT_RECORDS 65536       // for new logs; an existing log keeps its manifest's
+typedef struct {
+    uint32_t magic;
+    uint32_t records_per_segment;
+    uint32_t first_live;   // segments before this were moved to TXARCHIVE_DIR
+    uint32_t tail;         // the segment being appended to
+} TxManifest;
+
+// Archived segments are packed into TXPACK_FILE: this header, then blocks + 1
+// uint32_t file offsets (block b spans offsets[b] to offsets[b + 1]), then the
+// blocks of TXPACK_BLOCK_RECORDS records each. Blocks are encoded on their
+// own (see the server's Packed Segments), so any record is found by decoding
+// one block.
+#define TXPACK_MAGIC 0x314b5054u      // "TPK1"
+#define TXPACK_BLOCK_RECORDS 128
+typedef struct {
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t records;      // the manifest's records_per_segment
+    uint32_t blocks;
+} TxPackHeader;
+
 // Stored in USER_FILE
 typedef struct {
     int id; 
@@ -53,7 +105,18 @@ typedef struct {
     double balance;
 } Account;
 
-// Stored in TRANSACTION_FILE (append-only)
+// The known values of Transaction.type, as codes
+typedef enum {
+    TX_TYPE_OTHER = 0,
+    TX_TYPE_DEPOSIT,
+    TX_TYPE_WITHDRAW,
+    TX_TYPE_TRANSFER_OUT,
+    TX_TYPE_TRANSFER_IN,
+    TX_TYPE_LOAN_DEPOSIT,
+    TX_TYPE_COUNT
+} TxType;
+
+// Stored in the transaction log segments (append-only)
 typedef struct {
     int transaction_id;
     int account_id;
@@ -63,7 +126,24 @@ typedef struct {
     double new_balance;
 } Transaction;
 
-// Stored in LOAN_FILE (append-only)
+typedef enum {
+    LOAN_PENDING = 1,
+    LOAN_APPROVED = 2,
+    LOAN_REJECTED = 3
+} LoanStatus;
+
+// Stored in LOAN_FILE (append-only). Slot 0 holds the file header, so loan n
+// is the record in slot n.
+typedef struct {
+    int loan_id;
+    int customer_id;
+    double amount;
+    LoanStatus status;
+    int assigned_to_employee_id;
+} LoanRecord;
+
+// A loan as sent to clients. Also the record layout of LOAN_FILE before
+// LoanRecord; the server migrates such files at startup.
 typedef struct {
     int loan_id;
     int customer_id;
@@ -88,6 +168,8 @@ typedef enum {
     CHANGE_PASSWORD = 2, 
     LOGOUT = 3,
     EXIT = 4,
+    SERVER_STATS = 5,       // Per-opcode counters; no login needed
+    LIST_PAGE = 6,          // One page of a listing; framed protocol only
 
     // Customer operations
     CUST_VIEW_BALANCE = 11, 
@@ -97,6 +179,7 @@ typedef enum {
     CUST_APPLY_LOAN = 15,
     CUST_ADD_FEEDBACK = 17, 
     CUST_VIEW_HISTORY = 18, 
+    CUST_BATCH = 19,        // Framed protocol only
 
     // Employee operations
     EMP_ADD_CUSTOMER = 21,
@@ -104,6 +187,7 @@ typedef enum {
     EMP_PROCESS_LOAN = 23,
     EMP_VIEW_CUST_TX = 24,      
     EMP_VIEW_ASSIGNED_LOANS = 25, 
+    EMP_VIEW_TX_RANGE = 26,     // One account between two times; LIST_PAGE only
     
     // Manager operations
     MGR_ACTIVATE_USER = 31,
@@ -112,6 +196,8 @@ typedef enum {
     MGR_REVIEW_FEEDBACK = 34,
     MGR_VIEW_PENDING_LOANS = 35,
     MGR_VIEW_USER_LIST = 36,
+    MGR_AUDIT_TX_RANGE = 37,    // The whole bank between two times; LIST_PAGE only
+    MGR_TX_QUERY = 38,          // Framed protocol only
 
     // Admin operations
     ADMIN_ADD_USER = 41, 
@@ -121,6 +207,105 @@ typedef enum {
 
 } Operation;
 
+// --- Batch Operations (CUST_BATCH) ---
+
+// One deposit, withdrawal or transfer from the customer's own account.
+typedef struct {
+    Operation op;        // CUST_DEPOSIT, CUST_WITHDRAW or CUST_TRANSFER
+    int to_account_id;   // CUST_TRANSFER only
+    double amount;
+} BatchItem;
+
+typedef enum {
+    BATCH_OK = 0,
+    BATCH_INVALID_OP,
+    BATCH_INVALID_AMOUNT,
+    BATCH_INVALID_ACCOUNT,      // sender or recipient account does not exist
+    BATCH_RECIPIENT_INACTIVE,
+    BATCH_INSUFFICIENT_FUNDS
+} BatchStatus;
+
+typedef struct {
+    BatchStatus status;
+    double new_balance;  // customer's balance after this item
+} BatchResult;
+
+// --- Paged Listings (LIST_PAGE) ---
+// Any listing can be read a page at a time. The reply carries an opaque
+// cursor for the next page; pass it back unchanged, or 0 to start over. In
+// stream mode the server sends every page as its own reply frame, all with
+// the request's ID, until one arrives with next_cursor 0.
+//
+// The time-range listings return the transactions logged from `from` to `to`
+// inclusive: EMP_VIEW_TX_RANGE one account's, newest first, and
+// MGR_AUDIT_TX_RANGE the whole bank's, oldest first.
+
+typedef struct {
+    Operation list_op;  // CUST_VIEW_HISTORY, EMP_VIEW_CUST_TX, EMP_VIEW_TX_RANGE,
+                        // EMP_VIEW_ASSIGNED_LOANS, MGR_VIEW_PENDING_LOANS,
+                        // MGR_REVIEW_FEEDBACK, MGR_VIEW_USER_LIST, MGR_AUDIT_TX_RANGE
+                        // or ADMIN_VIEW_USER_LIST
+    int target;         // the account for EMP_VIEW_CUST_TX and EMP_VIEW_TX_RANGE,
+                        // the role for user lists
+    uint64_t cursor;
+    int limit;          // rows per page, 1 to MAX_PAGE_ROWS
+    int stream;
+    time_t from, to;    // time-range listings only
+} PageRequest;
+
+typedef struct {
+    Operation list_op;
+    uint64_t next_cursor; // 0 when this is the last page
+    int count;
+    union {               // heap-allocated, count rows of the list_op's type
+        Transaction* txs;
+        Loan* loans;
+        Feedback* feedback;
+        User* users;
+    } rows;
+} Page;
+
+// --- Transaction Queries (MGR_TX_QUERY) ---
+// The count, total, smallest and largest of one measure over every
+// transaction that passes all the filters, for the whole bank or per group.
+
+typedef enum {
+    TX_GROUP_NONE = 0,  // one row, key 0
+    TX_GROUP_DAY,       // key: days since the epoch, UTC
+    TX_GROUP_TYPE,      // key: TxType
+    TX_GROUP_ACCOUNT    // key: account ID
+} TxGroupBy;
+
+typedef enum {
+    TX_MEASURE_AMOUNT = 0,
+    TX_MEASURE_BALANCE   // new_balance
+} TxMeasure;
+
+typedef struct {
+    uint32_t types;      // bit (1 << TxType) for each type to include; 0 for all
+    int account_id;      // 0 for every account
+    time_t from, to;     // inclusive
+    double min_amount, max_amount; // inclusive
+    TxGroupBy group_by;
+    TxMeasure measure;
+} TxQuery;
+
+typedef struct {
+    int64_t key;
+    uint64_t count;
+    double sum, min, max; // of the measure; min and max are 0 if count is 0
+} TxQueryRow;
+
+// --- Server Statistics (SERVER_STATS) ---
+
+// Totals for one opcode since the server started.
+typedef struct {
+    int op;
+    unsigned long long requests;
+    unsigned long long db_syscalls; // pread/pwrite/fstat/fcntl on database files
+    unsigned long long busy_us;     // worker time spent on these requests
+} OpStats;
+
 // --- Request/Response Structures ---
 
 typedef struct {
@@ -148,6 +333,12 @@ typedef struct {
         } loan_action;
         char feedback_message[512];
         char new_password[100]; 
+        struct {
+            int count;
+            BatchItem* items; // heap-allocated by the decoder
+        } batch;
+        PageRequest page;
+        TxQuery query;
     } data;
 } Request;
 
@@ -181,6 +372,26 @@ typedef struct {
             int count;                
         } user_list;
         // --- END MODIFIED BLOCK ---
+
+        struct {
+            int count;
+            int succeeded;
+            BatchResult* results; // heap-allocated, one per request item
+        } batch;
+
+        struct {
+            OpStats ops[MAX_OP_STATS]; // only opcodes that have been used
+            int count;
+        } op_stats;
+
+        Page page;
+
+        struct {
+            uint64_t scanned;   // log records examined
+            int truncated;      // more than MAX_QUERY_GROUPS groups matched
+            int count;
+            TxQueryRow* rows;   // heap-allocated, sorted by key
+        } query;
         
     } data;
 } Response;
@@ -1,40 +1,86 @@
 #include "common.h"
+#include <glob.h>
+#include <sys/file.h>
+
+// Writes a keyed file (see KeyedFileHeader): the header slot, then the records.
+static void write_keyed_file(const char* path, const void* records, int n, size_t record_size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { perror(path); exit(EXIT_FAILURE); }
+    char* slot0 = calloc(1, record_size);
+    if (!slot0) { perror("calloc"); exit(EXIT_FAILURE); }
+    KeyedFileHeader hdr = { KEYED_FILE_MAGIC, (uint32_t)record_size };
+    memcpy(slot0, &hdr, sizeof(hdr));
+    if (write(fd, slot0, record_size) != (ssize_t)record_size ||
+        write(fd, records, (size_t)n * record_size) != (ssize_t)((size_t)n * record_size)) {
+        perror(path); exit(EXIT_FAILURE);
+    }
+    free(slot0);
+    close(fd);
+}
 
 // This utility creates the database files with initial data.
 int main() {
     int fd;
 
-    // --- Create Users ---
-    fd = open(USER_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd == -1) { perror("open USER_FILE"); exit(EXIT_FAILURE); }
+    // A running server holds LOCK_FILE (see claim_database) and would keep
+    // writing to the files replaced here
+    fd = open(LOCK_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) { perror(LOCK_FILE); exit(EXIT_FAILURE); }
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) fprintf(stderr, "%s: database is in use by a server\n", LOCK_FILE);
+        else perror("flock");
+        exit(EXIT_FAILURE);
+    }
 
-    User cust1 = {1001, CUSTOMER, "1001", "pass", "Alice Smith (Cust)", 1};
-    User cust2 = {1002, CUSTOMER, "1002", "pass", "Bob Johnson (Cust)", 1};
-    User emp1 = {2001, EMPLOYEE, "2001", "pass", "Charles Brown (Emp)", 1};
-    User mgr1 = {3001, MANAGER, "3001", "pass", "David Lee (Mgr)", 1};
-    User admin1 = {4001, ADMIN, "4001", "pass", "Eve White (Admin)", 1};
+    // The server's own state describes the old database: the WAL would
+    // replay its balance changes over the new accounts, and the indexes and
+    // ID map name its records. The server rebuilds each of them when missing.
+    const char* derived[] = { WAL_FILE, TXINDEX_FILE, TXHEADS_FILE, USERID_FILE };
+    for (size_t i = 0; i < sizeof(derived) / sizeof(derived[0]); i++) {
+        if (unlink(derived[i]) == -1 && errno != ENOENT) { perror(derived[i]); exit(EXIT_FAILURE); }
+    }
 
-    // Use lseek to write records at their ID's position (sparse file)
-    lseek(fd, 1001 * sizeof(User), SEEK_SET); write(fd, &cust1, sizeof(User));
-    lseek(fd, 1002 * sizeof(User), SEEK_SET); write(fd, &cust2, sizeof(User));
-    lseek(fd, 2001 * sizeof(User), SEEK_SET); write(fd, &emp1, sizeof(User));
-    lseek(fd, 3001 * sizeof(User), SEEK_SET); write(fd, &mgr1, sizeof(User));
-    lseek(fd, 4001 * sizeof(User), SEEK_SET); write(fd, &admin1, sizeof(User));
-    close(fd);
+    // --- Create Users ---
+    User users[] = {
+        {1001, CUSTOMER, "1001", "pass", "Alice Smith (Cust)", 1},
+        {1002, CUSTOMER, "1002", "pass", "Bob Johnson (Cust)", 1},
+        {2001, EMPLOYEE, "2001", "pass", "Charles Brown (Emp)", 1},
+        {3001, MANAGER, "3001", "pass", "David Lee (Mgr)", 1},
+        {4001, ADMIN, "4001", "pass", "Eve White (Admin)", 1},
+    };
+    write_keyed_file(USER_FILE, users, 5, sizeof(User));
     printf("User database created.\n");
 
     // --- Create Accounts ---
-    fd = open(ACCOUNT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd == -1) { perror("open ACCOUNT_FILE"); exit(EXIT_FAILURE); }
-    Account acc1 = {1001, 1001, 10000.00}; // Account for cust1
-    Account acc2 = {1002, 1002, 5000.00};  // Account for cust2
-    lseek(fd, 1001 * sizeof(Account), SEEK_SET); write(fd, &acc1, sizeof(Account));
-    lseek(fd, 1002 * sizeof(Account), SEEK_SET); write(fd, &acc2, sizeof(Account));
-    close(fd);
+    Account accounts[] = {
+        {1001, 1001, 10000.00}, // Account for cust1
+        {1002, 1002, 5000.00},  // Account for cust2
+    };
+    write_keyed_file(ACCOUNT_FILE, accounts, 2, sizeof(Account));
     printf("Account database created.\n");
 
     // --- Create Empty Transaction, Loan, and Feedback Files ---
-    fd = open(TRANSACTION_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644); close(fd);
+    // The log starts as one empty segment; segments left by an older
+    // database, live or archived, and a single-file log are removed.
+    glob_t old;
+    if (glob("db_txseg_*.dat", 0, NULL, &old) == 0) {
+        for (size_t i = 0; i < old.gl_pathc; i++) unlink(old.gl_pathv[i]);
+        globfree(&old);
+    }
+    if (glob(TXARCHIVE_DIR "/db_txseg_*", 0, NULL, &old) == 0) {
+        for (size_t i = 0; i < old.gl_pathc; i++) unlink(old.gl_pathv[i]);
+        globfree(&old);
+    }
+    unlink(TRANSACTION_FILE);
+    char segment[64];
+    snprintf(segment, sizeof(segment), TXSEGMENT_FILE, 0u);
+    fd = open(segment, O_WRONLY | O_CREAT | O_TRUNC, 0644); close(fd);
+    TxManifest manifest = { TXMANIFEST_MAGIC, TXSEGMENT_RECORDS, 0, 0 };
+    fd = open(TXMANIFEST_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, &manifest, sizeof(manifest)) != (ssize_t)sizeof(manifest)) {
+        perror(TXMANIFEST_FILE); exit(EXIT_FAILURE);
+    }
+    close(fd);
     printf("Transaction log created.\n");
     fd = open(LOAN_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644); close(fd);
     printf("Loan database created.\n");
@@ -42,4 +88,4 @@ int main() {
     printf("Feedback database created.\n");
     
     return 0;
-}
\ No newline at end of file
+}
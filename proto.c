@@ -0,0 +1,645 @@
+#include "proto.h"
+
+// --- Payload Writer ---
+typedef struct {
+    uint8_t* buf;
+    size_t len, cap;
+    int overflow;
+} Writer;
+
+static void put_bytes(Writer* w, const void* src, size_t n) {
+    if (w->overflow || w->cap - w->len < n) { w->overflow = 1; return; }
+    memcpy(w->buf + w->len, src, n);
+    w->len += n;
+}
+static void put_u8(Writer* w, uint8_t v) { put_bytes(w, &v, 1); }
+static void put_u16(Writer* w, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(w, b, 2);
+}
+static void put_u32(Writer* w, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    put_bytes(w, b, 4);
+}
+static void put_u64(Writer* w, uint64_t v) { put_u32(w, (uint32_t)(v >> 32)); put_u32(w, (uint32_t)v); }
+static void put_i32(Writer* w, int v) { put_u32(w, (uint32_t)v); }
+static void put_f64(Writer* w, double v) { uint64_t bits; memcpy(&bits, &v, 8); put_u64(w, bits); }
+static void put_str(Writer* w, const char* s, size_t max) {
+    size_t n = strnlen(s, max);
+    put_u16(w, (uint16_t)n);
+    put_bytes(w, s, n);
+}
+
+// --- Payload Reader ---
+typedef struct {
+    const uint8_t* buf;
+    size_t len, pos;
+    int error;
+} Reader;
+
+static const uint8_t* take(Reader* r, size_t n) {
+    if (r->error || r->len - r->pos < n) { r->error = 1; return NULL; }
+    const uint8_t* p = r->buf + r->pos;
+    r->pos += n;
+    return p;
+}
+static uint8_t get_u8(Reader* r) { const uint8_t* p = take(r, 1); return p ? p[0] : 0; }
+static uint16_t get_u16(Reader* r) {
+    const uint8_t* p = take(r, 2);
+    return p ? (uint16_t)((p[0] << 8) | p[1]) : 0;
+}
+static uint32_t get_u32(Reader* r) {
+    const uint8_t* p = take(r, 4);
+    return p ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3] : 0;
+}
+static uint64_t get_u64(Reader* r) { uint64_t hi = get_u32(r); return (hi << 32) | get_u32(r); }
+static int get_i32(Reader* r) { return (int)get_u32(r); }
+static double get_f64(Reader* r) { uint64_t bits = get_u64(r); double v; memcpy(&v, &bits, 8); return v; }
+// Copies a string into dst[size], truncating if needed; always terminates.
+static void get_str(Reader* r, char* dst, size_t size) {
+    uint16_t n = get_u16(r);
+    const uint8_t* p = take(r, n);
+    if (!p) { dst[0] = '\0'; return; }
+    size_t keep = (n < size - 1) ? n : size - 1;
+    memcpy(dst, p, keep);
+    dst[keep] = '\0';
+}
+
+// --- Frame Header ---
+static size_t header_size(uint8_t version) {
+    return (version == 1) ? PROTO_HEADER_SIZE_V1 : PROTO_HEADER_SIZE;
+}
+
+static uint32_t load_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int proto_parse_header(const uint8_t* buf, size_t avail, FrameHeader* hdr) {
+    if (avail < 3) return 0;
+    if (buf[0] != PROTO_MAGIC0 || buf[1] != PROTO_MAGIC1) return -1;
+    if (buf[2] < 1 || buf[2] > PROTO_VERSION) return -1;
+    hdr->version = buf[2];
+    hdr->size = header_size(buf[2]);
+    if (avail < hdr->size) return 0;
+    hdr->op = buf[3];
+    hdr->length = load_u32(buf + 4);
+    hdr->request_id = (hdr->version >= 2) ? load_u32(buf + 8) : 0;
+    return (hdr->length <= PROTO_MAX_PAYLOAD) ? 1 : -1;
+}
+
+// Payloads are written after room for the largest header; the header is
+// filled in, and the payload moved up for shorter headers, once its length
+// is known. Returns the frame size, or 0 on overflow.
+static size_t finish_frame(Writer* w, uint8_t version, uint8_t op, uint32_t request_id) {
+    size_t payload = w->len - PROTO_HEADER_SIZE;
+    if (w->overflow || payload > PROTO_MAX_PAYLOAD) return 0;
+    size_t hsize = header_size(version);
+    if (hsize != PROTO_HEADER_SIZE) memmove(w->buf + hsize, w->buf + PROTO_HEADER_SIZE, payload);
+
+    uint8_t* b = w->buf;
+    b[0] = PROTO_MAGIC0; b[1] = PROTO_MAGIC1; b[2] = version; b[3] = op;
+    b[4] = (uint8_t)(payload >> 24); b[5] = (uint8_t)(payload >> 16);
+    b[6] = (uint8_t)(payload >> 8);  b[7] = (uint8_t)payload;
+    if (version >= 2) {
+        b[8] = (uint8_t)(request_id >> 24); b[9] = (uint8_t)(request_id >> 16);
+        b[10] = (uint8_t)(request_id >> 8); b[11] = (uint8_t)request_id;
+    }
+    return hsize + payload;
+}
+
+// --- Request Payloads ---
+size_t proto_encode_request(const Request* req, uint32_t request_id, uint8_t* buf, size_t cap) {
+    Writer w = { buf, PROTO_HEADER_SIZE, cap, cap < PROTO_HEADER_SIZE };
+
+    switch (req->op) {
+        case LOGIN:
+            put_str(&w, req->username, sizeof(req->username));
+            put_str(&w, req->password, sizeof(req->password));
+            put_u8(&w, (uint8_t)req->intended_role);
+            break;
+        case CHANGE_PASSWORD:
+            put_str(&w, req->data.new_password, sizeof(req->data.new_password));
+            break;
+        case CUST_DEPOSIT:
+        case CUST_WITHDRAW:
+        case CUST_APPLY_LOAN:
+            put_f64(&w, req->data.amount);
+            break;
+        case CUST_TRANSFER:
+            put_i32(&w, req->data.transfer.to_account_id);
+            put_f64(&w, req->data.transfer.amount);
+            break;
+        case CUST_ADD_FEEDBACK:
+            put_str(&w, req->data.feedback_message, sizeof(req->data.feedback_message));
+            break;
+        case EMP_ADD_CUSTOMER:
+            put_str(&w, req->data.user_data.name, sizeof(req->data.user_data.name));
+            put_str(&w, req->data.user_data.password, sizeof(req->data.user_data.password));
+            break;
+        case EMP_MOD_CUSTOMER:
+            put_i32(&w, req->data.target_user_id);
+            put_str(&w, req->data.user_data.name, sizeof(req->data.user_data.name));
+            break;
+        case EMP_PROCESS_LOAN:
+            put_i32(&w, req->data.loan_action.loan_id);
+            put_u8(&w, (uint8_t)req->data.loan_action.approve);
+            break;
+        case EMP_VIEW_CUST_TX:
+        case MGR_ACTIVATE_USER:
+        case MGR_DEACTIVATE_USER:
+        case ADMIN_DELETE_USER:
+            put_i32(&w, req->data.target_user_id);
+            break;
+        case MGR_ASSIGN_LOAN:
+            put_i32(&w, req->data.loan_assignment.loan_id);
+            put_i32(&w, req->data.loan_assignment.employee_id);
+            break;
+        case MGR_VIEW_USER_LIST:
+        case ADMIN_VIEW_USER_LIST:
+            put_u8(&w, (uint8_t)req->data.user_data.role);
+            break;
+        case ADMIN_ADD_USER:
+            put_u8(&w, (uint8_t)req->data.user_data.role);
+            put_str(&w, req->data.user_data.name, sizeof(req->data.user_data.name));
+            put_str(&w, req->data.user_data.password, sizeof(req->data.user_data.password));
+            break;
+        case ADMIN_MOD_USER:
+            put_i32(&w, req->data.target_user_id);
+            put_str(&w, req->data.user_data.name, sizeof(req->data.user_data.name));
+            put_str(&w, req->data.user_data.password, sizeof(req->data.user_data.password));
+            put_u8(&w, (uint8_t)req->data.user_data.role);
+            put_u8(&w, (uint8_t)req->data.user_data.isActive);
+            break;
+        case CUST_BATCH:
+            put_u32(&w, (uint32_t)req->data.batch.count);
+            for (int i = 0; i < req->data.batch.count; i++) {
+                const BatchItem* item = &req->data.batch.items[i];
+                put_u8(&w, (uint8_t)item->op);
+                put_i32(&w, item->to_account_id);
+                put_f64(&w, item->amount);
+            }
+            break;
+        case LIST_PAGE:
+            put_u8(&w, (uint8_t)req->data.page.list_op);
+            put_i32(&w, req->data.page.target);
+            put_u64(&w, req->data.page.cursor);
+            put_u16(&w, (uint16_t)req->data.page.limit);
+            put_u8(&w, (uint8_t)(req->data.page.stream != 0));
+            if (req->data.page.list_op == EMP_VIEW_TX_RANGE || req->data.page.list_op == MGR_AUDIT_TX_RANGE) {
+                put_u64(&w, (uint64_t)req->data.page.from);
+                put_u64(&w, (uint64_t)req->data.page.to);
+            }
+            break;
+        case MGR_TX_QUERY:
+            put_u32(&w, req->data.query.types);
+            put_i32(&w, req->data.query.account_id);
+            put_u64(&w, (uint64_t)req->data.query.from);
+            put_u64(&w, (uint64_t)req->data.query.to);
+            put_f64(&w, req->data.query.min_amount);
+            put_f64(&w, req->data.query.max_amount);
+            put_u8(&w, (uint8_t)req->data.query.group_by);
+            put_u8(&w, (uint8_t)req->data.query.measure);
+            break;
+        default: // LOGOUT, EXIT, SERVER_STATS and the plain views carry no payload
+            break;
+    }
+    return finish_frame(&w, PROTO_VERSION, (uint8_t)req->op, request_id);
+}
+
+int proto_decode_request(const FrameHeader* hdr, const uint8_t* payload, Request* req) {
+    Reader r = { payload, hdr->length, 0, 0 };
+    memset(req, 0, sizeof(Request));
+    req->op = (Operation)hdr->op;
+
+    switch (req->op) {
+        case LOGIN:
+            get_str(&r, req->username, sizeof(req->username));
+            get_str(&r, req->password, sizeof(req->password));
+            req->intended_role = (UserRole)get_u8(&r);
+            break;
+        case CHANGE_PASSWORD:
+            get_str(&r, req->data.new_password, sizeof(req->data.new_password));
+            break;
+        case CUST_DEPOSIT:
+        case CUST_WITHDRAW:
+        case CUST_APPLY_LOAN:
+            req->data.amount = get_f64(&r);
+            break;
+        case CUST_TRANSFER:
+            req->data.transfer.to_account_id = get_i32(&r);
+            req->data.transfer.amount = get_f64(&r);
+            break;
+        case CUST_ADD_FEEDBACK:
+            get_str(&r, req->data.feedback_message, sizeof(req->data.feedback_message));
+            break;
+        case EMP_ADD_CUSTOMER:
+            get_str(&r, req->data.user_data.name, sizeof(req->data.user_data.name));
+            get_str(&r, req->data.user_data.password, sizeof(req->data.user_data.password));
+            break;
+        case EMP_MOD_CUSTOMER:
+            req->data.target_user_id = get_i32(&r);
+            get_str(&r, req->data.user_data.name, sizeof(req->data.user_data.name));
+            break;
+        case EMP_PROCESS_LOAN:
+            req->data.loan_action.loan_id = get_i32(&r);
+            req->data.loan_action.approve = get_u8(&r);
+            break;
+        case EMP_VIEW_CUST_TX:
+        case MGR_ACTIVATE_USER:
+        case MGR_DEACTIVATE_USER:
+        case ADMIN_DELETE_USER:
+            req->data.target_user_id = get_i32(&r);
+            break;
+        case MGR_ASSIGN_LOAN:
+            req->data.loan_assignment.loan_id = get_i32(&r);
+            req->data.loan_assignment.employee_id = get_i32(&r);
+            break;
+        case MGR_VIEW_USER_LIST:
+        case ADMIN_VIEW_USER_LIST:
+            req->data.user_data.role = (UserRole)get_u8(&r);
+            break;
+        case ADMIN_ADD_USER:
+            req->data.user_data.role = (UserRole)get_u8(&r);
+            get_str(&r, req->data.user_data.name, sizeof(req->data.user_data.name));
+            get_str(&r, req->data.user_data.password, sizeof(req->data.user_data.password));
+            break;
+        case ADMIN_MOD_USER:
+            req->data.target_user_id = get_i32(&r);
+            get_str(&r, req->data.user_data.name, sizeof(req->data.user_data.name));
+            get_str(&r, req->data.user_data.password, sizeof(req->data.user_data.password));
+            req->data.user_data.role = (UserRole)get_u8(&r);
+            req->data.user_data.isActive = get_u8(&r);
+            break;
+        case CUST_BATCH: {
+            uint32_t n = get_u32(&r);
+            if (r.error || n == 0 || n > MAX_BATCH_ITEMS) return 0;
+            BatchItem* items = (BatchItem*)calloc(n, sizeof(BatchItem));
+            if (!items) return 0;
+            for (uint32_t i = 0; i < n; i++) {
+                items[i].op = (Operation)get_u8(&r);
+                items[i].to_account_id = get_i32(&r);
+                items[i].amount = get_f64(&r);
+            }
+            if (r.error) { free(items); return 0; }
+            req->data.batch.count = (int)n;
+            req->data.batch.items = items;
+            break;
+        }
+        case LIST_PAGE:
+            req->data.page.list_op = (Operation)get_u8(&r);
+            req->data.page.target = get_i32(&r);
+            req->data.page.cursor = get_u64(&r);
+            req->data.page.limit = get_u16(&r);
+            req->data.page.stream = get_u8(&r);
+            if (req->data.page.list_op == EMP_VIEW_TX_RANGE || req->data.page.list_op == MGR_AUDIT_TX_RANGE) {
+                req->data.page.from = (time_t)get_u64(&r);
+                req->data.page.to = (time_t)get_u64(&r);
+            }
+            break;
+        case MGR_TX_QUERY:
+            req->data.query.types = get_u32(&r);
+            req->data.query.account_id = get_i32(&r);
+            req->data.query.from = (time_t)get_u64(&r);
+            req->data.query.to = (time_t)get_u64(&r);
+            req->data.query.min_amount = get_f64(&r);
+            req->data.query.max_amount = get_f64(&r);
+            req->data.query.group_by = (TxGroupBy)get_u8(&r);
+            req->data.query.measure = (TxMeasure)get_u8(&r);
+            break;
+        default:
+            break;
+    }
+    return !r.error;
+}
+
+void proto_release_request(Request* req) {
+    if (req->op == CUST_BATCH) {
+        free(req->data.batch.items);
+        req->data.batch.items = NULL;
+    }
+}
+
+// --- Response Payloads ---
+// Every response starts with success (u8) and message (str). Opcode-specific
+// data follows only on success.
+static void put_user(Writer* w, const User* u) {
+    // Passwords never leave the server in the framed protocol.
+    put_i32(w, u->id);
+    put_u8(w, (uint8_t)u->role);
+    put_str(w, u->name, sizeof(u->name));
+    put_u8(w, (uint8_t)u->isActive);
+}
+static void get_user(Reader* r, User* u) {
+    u->id = get_i32(r);
+    u->role = (UserRole)get_u8(r);
+    get_str(r, u->name, sizeof(u->name));
+    u->isActive = get_u8(r);
+    snprintf(u->username, sizeof(u->username), "%d", u->id);
+}
+
+static void put_transaction(Writer* w, const Transaction* tx) {
+    put_i32(w, tx->transaction_id);
+    put_i32(w, tx->account_id);
+    put_u64(w, (uint64_t)tx->timestamp);
+    put_str(w, tx->type, sizeof(tx->type));
+    put_f64(w, tx->amount);
+    put_f64(w, tx->new_balance);
+}
+static void get_transaction(Reader* r, Transaction* tx) {
+    tx->transaction_id = get_i32(r);
+    tx->account_id = get_i32(r);
+    tx->timestamp = (time_t)get_u64(r);
+    get_str(r, tx->type, sizeof(tx->type));
+    tx->amount = get_f64(r);
+    tx->new_balance = get_f64(r);
+}
+
+static void put_loan(Writer* w, const Loan* loan) {
+    put_i32(w, loan->loan_id);
+    put_i32(w, loan->customer_id);
+    put_f64(w, loan->amount);
+    put_str(w, loan->status, sizeof(loan->status));
+    put_i32(w, loan->assigned_to_employee_id);
+}
+static void get_loan(Reader* r, Loan* loan) {
+    loan->loan_id = get_i32(r);
+    loan->customer_id = get_i32(r);
+    loan->amount = get_f64(r);
+    get_str(r, loan->status, sizeof(loan->status));
+    loan->assigned_to_employee_id = get_i32(r);
+}
+
+static void put_feedback(Writer* w, const Feedback* fb) {
+    put_i32(w, fb->feedback_id);
+    put_i32(w, fb->customer_id);
+    put_u64(w, (uint64_t)fb->timestamp);
+    put_str(w, fb->message, sizeof(fb->message));
+}
+static void get_feedback(Reader* r, Feedback* fb) {
+    fb->feedback_id = get_i32(r);
+    fb->customer_id = get_i32(r);
+    fb->timestamp = (time_t)get_u64(r);
+    get_str(r, fb->message, sizeof(fb->message));
+}
+
+// Lists whose count is a running total may hold fewer entries than count.
+static int clamp_count(int count, int cap) {
+    if (count < 0) return 0;
+    return (count > cap) ? cap : count;
+}
+
+size_t proto_encode_response(const FrameHeader* req_hdr, const Response* res, uint8_t* buf, size_t cap) {
+    Writer w = { buf, PROTO_HEADER_SIZE, cap, cap < PROTO_HEADER_SIZE };
+    Operation op = (Operation)req_hdr->op;
+    put_u8(&w, (uint8_t)(res->success != 0));
+    put_str(&w, res->message, sizeof(res->message));
+    if (!res->success) return finish_frame(&w, req_hdr->version, req_hdr->op, req_hdr->request_id);
+
+    switch (op) {
+        case LOGIN:
+            put_user(&w, &res->data.user);
+            break;
+        case CUST_VIEW_BALANCE:
+            put_f64(&w, res->data.balance);
+            break;
+        case CUST_VIEW_HISTORY:
+        case EMP_VIEW_CUST_TX: {
+            int n = clamp_count(res->data.tx_history.history_count, MAX_TRANSACTIONS);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) put_transaction(&w, &res->data.tx_history.history[i]);
+            break;
+        }
+        case EMP_VIEW_ASSIGNED_LOANS:
+        case MGR_VIEW_PENDING_LOANS: {
+            int n = clamp_count(res->data.loan_list.loan_count, 20);
+            put_i32(&w, res->data.loan_list.loan_count);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) put_loan(&w, &res->data.loan_list.loans[i]);
+            break;
+        }
+        case MGR_REVIEW_FEEDBACK: {
+            int n = clamp_count(res->data.feedback.count, 50);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) put_feedback(&w, &res->data.feedback.list[i]);
+            break;
+        }
+        case MGR_VIEW_USER_LIST:
+        case ADMIN_VIEW_USER_LIST: {
+            int n = clamp_count(res->data.user_list.count, MAX_USER_LIST);
+            put_i32(&w, res->data.user_list.count);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) put_user(&w, &res->data.user_list.list[i]);
+            break;
+        }
+        case SERVER_STATS: {
+            int n = clamp_count(res->data.op_stats.count, MAX_OP_STATS);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) {
+                const OpStats* st = &res->data.op_stats.ops[i];
+                put_u8(&w, (uint8_t)st->op);
+                put_u64(&w, st->requests);
+                put_u64(&w, st->db_syscalls);
+                put_u64(&w, st->busy_us);
+            }
+            break;
+        }
+        case LIST_PAGE: {
+            const Page* page = &res->data.page;
+            int n = clamp_count(page->count, MAX_PAGE_ROWS);
+            put_u8(&w, (uint8_t)page->list_op);
+            put_u64(&w, page->next_cursor);
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) {
+                switch (page->list_op) {
+                    case CUST_VIEW_HISTORY:
+                    case EMP_VIEW_CUST_TX:
+                    case EMP_VIEW_TX_RANGE:
+                    case MGR_AUDIT_TX_RANGE:     put_transaction(&w, &page->rows.txs[i]); break;
+                    case EMP_VIEW_ASSIGNED_LOANS:
+                    case MGR_VIEW_PENDING_LOANS: put_loan(&w, &page->rows.loans[i]); break;
+                    case MGR_REVIEW_FEEDBACK:    put_feedback(&w, &page->rows.feedback[i]); break;
+                    default:                     put_user(&w, &page->rows.users[i]); break;
+                }
+            }
+            break;
+        }
+        case MGR_TX_QUERY: {
+            int n = clamp_count(res->data.query.count, MAX_QUERY_GROUPS);
+            put_u64(&w, res->data.query.scanned);
+            put_u8(&w, (uint8_t)(res->data.query.truncated != 0));
+            put_u16(&w, (uint16_t)n);
+            for (int i = 0; i < n; i++) {
+                const TxQueryRow* row = &res->data.query.rows[i];
+                put_u64(&w, (uint64_t)row->key);
+                put_u64(&w, row->count);
+                put_f64(&w, row->sum);
+                put_f64(&w, row->min);
+                put_f64(&w, row->max);
+            }
+            break;
+        }
+        case CUST_BATCH:
+            put_u32(&w, (uint32_t)res->data.batch.count);
+            put_u32(&w, (uint32_t)res->data.batch.succeeded);
+            for (int i = 0; i < res->data.batch.count; i++) {
+                put_u8(&w, (uint8_t)res->data.batch.results[i].status);
+                put_f64(&w, res->data.batch.results[i].new_balance);
+            }
+            break;
+        default: // Everything else only reports success and a message
+            break;
+    }
+    return finish_frame(&w, req_hdr->version, req_hdr->op, req_hdr->request_id);
+}
+
+int proto_decode_response(const FrameHeader* hdr, const uint8_t* payload, Response* res) {
+    Reader r = { payload, hdr->length, 0, 0 };
+    memset(res, 0, sizeof(Response));
+    res->success = get_u8(&r);
+    get_str(&r, res->message, sizeof(res->message));
+    if (!res->success) return !r.error;
+
+    switch ((Operation)hdr->op) {
+        case LOGIN:
+            get_user(&r, &res->data.user);
+            break;
+        case CUST_VIEW_BALANCE:
+            res->data.balance = get_f64(&r);
+            break;
+        case CUST_VIEW_HISTORY:
+        case EMP_VIEW_CUST_TX: {
+            int n = get_u16(&r);
+            if (n > MAX_TRANSACTIONS) return 0;
+            for (int i = 0; i < n; i++) get_transaction(&r, &res->data.tx_history.history[i]);
+            res->data.tx_history.history_count = n;
+            break;
+        }
+        case EMP_VIEW_ASSIGNED_LOANS:
+        case MGR_VIEW_PENDING_LOANS: {
+            res->data.loan_list.loan_count = get_i32(&r);
+            int n = get_u16(&r);
+            if (n > 20) return 0;
+            for (int i = 0; i < n; i++) get_loan(&r, &res->data.loan_list.loans[i]);
+            break;
+        }
+        case MGR_REVIEW_FEEDBACK: {
+            int n = get_u16(&r);
+            if (n > 50) return 0;
+            for (int i = 0; i < n; i++) get_feedback(&r, &res->data.feedback.list[i]);
+            res->data.feedback.count = n;
+            break;
+        }
+        case MGR_VIEW_USER_LIST:
+        case ADMIN_VIEW_USER_LIST: {
+            res->data.user_list.count = get_i32(&r);
+            int n = get_u16(&r);
+            if (n > MAX_USER_LIST) return 0;
+            for (int i = 0; i < n; i++) get_user(&r, &res->data.user_list.list[i]);
+            break;
+        }
+        case SERVER_STATS: {
+            int n = get_u16(&r);
+            if (n > MAX_OP_STATS) return 0;
+            res->data.op_stats.count = n;
+            for (int i = 0; i < n; i++) {
+                OpStats* st = &res->data.op_stats.ops[i];
+                st->op = get_u8(&r);
+                st->requests = get_u64(&r);
+                st->db_syscalls = get_u64(&r);
+                st->busy_us = get_u64(&r);
+            }
+            break;
+        }
+        case CUST_BATCH: {
+            uint32_t n = get_u32(&r);
+            int succeeded = (int)get_u32(&r);
+            if (r.error || n > MAX_BATCH_ITEMS) return 0;
+            BatchResult* results = (BatchResult*)calloc(n ? n : 1, sizeof(BatchResult));
+            if (!results) return 0;
+            for (uint32_t i = 0; i < n; i++) {
+                results[i].status = (BatchStatus)get_u8(&r);
+                results[i].new_balance = get_f64(&r);
+            }
+            if (r.error) { free(results); return 0; }
+            res->data.batch.count = (int)n;
+            res->data.batch.succeeded = succeeded;
+            res->data.batch.results = results;
+            break;
+        }
+        case MGR_TX_QUERY: {
+            res->data.query.scanned = get_u64(&r);
+            res->data.query.truncated = get_u8(&r);
+            int n = get_u16(&r);
+            if (r.error || n > MAX_QUERY_GROUPS) return 0;
+            TxQueryRow* rows = (TxQueryRow*)calloc(n ? (size_t)n : 1, sizeof(TxQueryRow));
+            if (!rows) return 0;
+            for (int i = 0; i < n; i++) {
+                rows[i].key = (int64_t)get_u64(&r);
+                rows[i].count = get_u64(&r);
+                rows[i].sum = get_f64(&r);
+                rows[i].min = get_f64(&r);
+                rows[i].max = get_f64(&r);
+            }
+            if (r.error) { free(rows); return 0; }
+            res->data.query.count = n;
+            res->data.query.rows = rows;
+            break;
+        }
+        case LIST_PAGE: {
+            Page* page = &res->data.page;
+            page->list_op = (Operation)get_u8(&r);
+            page->next_cursor = get_u64(&r);
+            int n = get_u16(&r);
+            if (r.error || n > MAX_PAGE_ROWS) return 0;
+            size_t row_size;
+            switch (page->list_op) {
+                case CUST_VIEW_HISTORY:
+                case EMP_VIEW_CUST_TX:
+                case EMP_VIEW_TX_RANGE:
+                case MGR_AUDIT_TX_RANGE:      row_size = sizeof(Transaction); break;
+                case EMP_VIEW_ASSIGNED_LOANS:
+                case MGR_VIEW_PENDING_LOANS:  row_size = sizeof(Loan); break;
+                case MGR_REVIEW_FEEDBACK:     row_size = sizeof(Feedback); break;
+                case MGR_VIEW_USER_LIST:
+                case ADMIN_VIEW_USER_LIST:    row_size = sizeof(User); break;
+                default:                      return 0;
+            }
+            void* rows = calloc(n ? (size_t)n : 1, row_size);
+            if (!rows) return 0;
+            page->rows.txs = (Transaction*)rows;
+            for (int i = 0; i < n; i++) {
+                switch (page->list_op) {
+                    case CUST_VIEW_HISTORY:
+                    case EMP_VIEW_CUST_TX:
+                    case EMP_VIEW_TX_RANGE:
+                    case MGR_AUDIT_TX_RANGE:     get_transaction(&r, &page->rows.txs[i]); break;
+                    case EMP_VIEW_ASSIGNED_LOANS:
+                    case MGR_VIEW_PENDING_LOANS: get_loan(&r, &page->rows.loans[i]); break;
+                    case MGR_REVIEW_FEEDBACK:    get_feedback(&r, &page->rows.feedback[i]); break;
+                    default:                     get_user(&r, &page->rows.users[i]); break;
+                }
+            }
+            if (r.error) { free(rows); page->rows.txs = NULL; return 0; }
+            page->count = n;
+            break;
+        }
+        default:
+            break;
+    }
+    return !r.error;
+}
+
+void proto_release_response(Operation op, Response* res) {
+    if (op == CUST_BATCH && res->success) {
+        free(res->data.batch.results);
+        res->data.batch.results = NULL;
+    }
+    if (op == LIST_PAGE && res->success) {
+        free(res->data.page.rows.txs); // any member; they share the allocation
+        res->data.page.rows.txs = NULL;
+    }
+    if (op == MGR_TX_QUERY && res->success) {
+        free(res->data.query.rows);
+        res->data.query.rows = NULL;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include "common.h"
+#include <stdint.h>
+
+// --- Framed Wire Protocol ---
+// Every message is a fixed header followed by an opcode-specific payload:
+//
+//   'B' 'K' | version (u8) | op (u8) | payload length (u32) | request ID (u32)
+//
+// The request ID (version 2 and later) is chosen by the client and echoed in
+// the reply, so a client may keep many requests in flight on one connection
+// and match replies that arrive out of order. Version 1 frames have no ID
+// field and are answered strictly in order.
+//
+// Payloads carry only the fields their opcode uses and lists carry only
+// `count` elements. All integers are big-endian, doubles travel as the
+// big-endian bits of their IEEE-754 value, and strings are a u16 length
+// followed by the bytes (no terminator).
+//
+// Old clients that write the raw Request struct are told apart by the first
+// two bytes: no valid Operation starts with 'B' 'K' in memory.
+
+#define PROTO_MAGIC0 'B'
+#define PROTO_MAGIC1 'K'
+#define PROTO_VERSION 2
+#define PROTO_HEADER_SIZE_V1 8
+#define PROTO_HEADER_SIZE 12
+#define PROTO_MAX_PAYLOAD (64 * 1024)
+#define PROTO_MAX_FRAME (PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD)
+
+typedef struct {
+    uint8_t version;
+    uint8_t op;
+    uint32_t length;     // payload bytes following the header
+    uint32_t request_id; // 0 for version 1 frames
+    size_t size;         // header bytes for this version
+} FrameHeader;
+
+// Parses the header at the start of buf[0..avail). Returns 1 when hdr is
+// filled, 0 if more bytes are needed, and -1 if this is not a frame this
+// build understands.
+int proto_parse_header(const uint8_t* buf, size_t avail, FrameHeader* hdr);
+
+// Encoders write a whole frame (header + payload) and return its size,
+// or 0 if it does not fit in cap bytes. Requests are always sent with the
+// current version; a reply mirrors the version, opcode and ID of req_hdr.
+size_t proto_encode_request(const Request* req, uint32_t request_id, uint8_t* buf, size_t cap);
+size_t proto_encode_response(const FrameHeader* req_hdr, const Response* res, uint8_t* buf, size_t cap);
+
+// Decoders fill a zeroed struct from a payload. They return 0 if the
+// payload is truncated or malformed.
+int proto_decode_request(const FrameHeader* hdr, const uint8_t* payload, Request* req);
+int proto_decode_response(const FrameHeader* hdr, const uint8_t* payload, Response* res);
+
+// Frees the heap parts of a decoded (or server-built) message: the item list
+// of a CUST_BATCH request, the result list of its reply and the rows of a
+// LIST_PAGE or MGR_TX_QUERY reply.
+void proto_release_request(Request* req);
+void proto_release_response(Operation op, Response* res);
+
+#endif // PROTO_H
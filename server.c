@@ -1,110 +1,3577 @@
+#define _GNU_SOURCE // accept4
 #include "common.h"
-
-// Global array for session management (index = user_id)
-// 0 = logged out, 1 = logged in
-int active_sessions[5000];
-// Mutex to protect the active_sessions array
-pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+#include "proto.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <float.h>
 
 // --- New: In-process concurrency control ---
-#define MAX_ID 5005
-static pthread_mutex_t account_mutexes[MAX_ID];     // one mutex per account/user id
 static pthread_mutex_t txlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Appends compute their offset from the file size, so writers in this process
+// must not overlap (fcntl locks do not exclude threads of the same process)
+static pthread_mutex_t loan_append_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t feedback_append_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// --- Lock Manager ---
+// Locks for account, user and loan IDs. IDs hash onto LOCK_STRIPES mutexes, so any
+// ID space shares one fixed table. lock_keys() takes any number of IDs,
+// locking each stripe once and in ascending stripe order; every caller that
+// holds more than one stripe goes through it, so two callers can never
+// deadlock. Only writers lock: readers copy records without a lock and check
+// the copy against the record's version number (see version_write_begin()).
+// The stripes live in this process only: a database has one server (see
+// claim_database()), and nothing else writes accounts.
+//
+// Each stripe counts its acquisitions and the ones that had to wait, with the
+// waits in a log2 histogram. dump_stats() lists the stripes that waited
+// longest with the last ID that waited on each, to find hot accounts.
+#define LOCK_STRIPE_BITS 10
+#define LOCK_STRIPES (1 << LOCK_STRIPE_BITS)
+#define LOCK_WAIT_BUCKETS 16     // bucket b counts waits under 2^b us; the last one the rest
+
+typedef struct {
+    pthread_mutex_t lock;
+    _Atomic uint64_t acquired, waited, wait_ns;
+    _Atomic int32_t last_waiter;                  // ID of the latest acquisition that waited
+    _Atomic uint64_t wait_hist[LOCK_WAIT_BUCKETS];
+} __attribute__((aligned(64))) LockStripe;
+
+static LockStripe lock_stripes[LOCK_STRIPES];
+
+static void init_lock_manager(void) {
+    for (int i = 0; i < LOCK_STRIPES; i++) pthread_mutex_init(&lock_stripes[i].lock, NULL);
+}
+
+static inline int lock_stripe_of(int id) {
+    return (int)(((uint32_t)id * 0x9e3779b1u) >> (32 - LOCK_STRIPE_BITS));
+}
+
+static void stripe_acquire(int s, int id) {
+    LockStripe* st = &lock_stripes[s];
+    uint64_t start = 0;
+    if (pthread_mutex_trylock(&st->lock) != 0) {
+        start = now_ns();
+        pthread_mutex_lock(&st->lock);
+    }
+    if (start) {
+        uint64_t waited = now_ns() - start;
+        int bucket = 0;
+        while (bucket < LOCK_WAIT_BUCKETS - 1 && waited >= (1000ull << bucket)) bucket++;
+        atomic_fetch_add_explicit(&st->waited, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->wait_ns, waited, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->wait_hist[bucket], 1, memory_order_relaxed);
+        atomic_store_explicit(&st->last_waiter, id, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&st->acquired, 1, memory_order_relaxed);
+}
+static void stripe_release(int s) {
+    pthread_mutex_unlock(&lock_stripes[s].lock);
+}
+
+// Version numbers let a reader copy a record without taking its lock. A
+// writer holding the ID's stripe makes the number odd while it changes the
+// record and even again afterwards; a copy taken between two loads of the
+// same even number is consistent. Each record has its own number, kept in a
+// per slot array next to its store.
+static inline uint32_t version_write_begin(_Atomic uint32_t* v) {
+    uint32_t seq = atomic_load_explicit(v, memory_order_relaxed);
+    atomic_store_explicit(v, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return seq;
+}
+static inline void version_write_end(_Atomic uint32_t* v, uint32_t seq) {
+    atomic_store_explicit(v, seq + 2, memory_order_release);
+}
+static inline uint32_t version_read_begin(_Atomic uint32_t* v) {
+    while (1) {
+        uint32_t seq = atomic_load_explicit(v, memory_order_acquire);
+        if (!(seq & 1)) return seq;
+        sched_yield(); // a write is in progress
+    }
+}
+static inline int version_read_valid(_Atomic uint32_t* v, uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(v, memory_order_relaxed) == seq;
+}
+
+static void stripe_mask(const int* ids, int n, uint64_t* mask) {
+    memset(mask, 0, LOCK_STRIPES / 8);
+    for (int i = 0; i < n; i++) mask[lock_stripe_of(ids[i]) / 64] |= 1ull << (lock_stripe_of(ids[i]) % 64);
+}
+
+// Locks every ID in ids, in any order and with repeats allowed.
+static void lock_keys(const int* ids, int n) {
+    uint64_t mask[LOCK_STRIPES / 64];
+    stripe_mask(ids, n, mask);
+    int k = 0;
+    for (int w = 0; w < LOCK_STRIPES / 64; w++) {
+        for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+            int s = w * 64 + __builtin_ctzll(bits);
+            while (lock_stripe_of(ids[k]) != s) k = (k + 1) % n; // an ID on this stripe, for the stats
+            stripe_acquire(s, ids[k]);
+        }
+    }
+}
+static void unlock_keys(const int* ids, int n) {
+    uint64_t mask[LOCK_STRIPES / 64];
+    stripe_mask(ids, n, mask);
+    for (int w = LOCK_STRIPES / 64 - 1; w >= 0; w--) {
+        for (uint64_t bits = mask[w]; bits; ) {
+            int b = 63 - __builtin_clzll(bits);
+            stripe_release(w * 64 + b);
+            bits &= ~(1ull << b);
+        }
+    }
+}
+
+static inline void lock_account_one(int id)   { stripe_acquire(lock_stripe_of(id), id); }
+static inline void unlock_account_one(int id) { stripe_release(lock_stripe_of(id)); }
+// Canonical two-account locking to avoid deadlocks in A<->B transfers
+static inline void lock_account_pair(int a, int b) {
+    int ids[2] = { a, b };
+    lock_keys(ids, 2);
+}
+static inline void unlock_account_pair(int a, int b) {
+    int ids[2] = { a, b };
+    unlock_keys(ids, 2);
+}
+
+// Prints the totals and the stripes that spent longest waiting.
+static void dump_lock_stats(void) {
+    enum { TOP = 5 };
+    int top[TOP], ntop = 0;
+    uint64_t acquired = 0, waited = 0, wait_ns = 0;
+    for (int s = 0; s < LOCK_STRIPES; s++) {
+        LockStripe* st = &lock_stripes[s];
+        acquired += atomic_load(&st->acquired);
+        waited += atomic_load(&st->waited);
+        uint64_t ns = atomic_load(&st->wait_ns);
+        wait_ns += ns;
+        if (ns == 0) continue;
+        // Insertion into the top list, longest wait first
+        int pos = ntop < TOP ? ntop++ : TOP;
+        while (pos > 0 && atomic_load(&lock_stripes[top[pos - 1]].wait_ns) < ns) {
+            if (pos < TOP) top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < TOP) top[pos] = s;
+    }
+    printf("Locks: %llu acquisitions, %llu waited (%.2f%%), %.1f ms waiting\n", (unsigned long long)acquired,
+           (unsigned long long)waited, acquired ? 100.0 * (double)waited / (double)acquired : 0.0, (double)wait_ns / 1e6);
+    for (int i = 0; i < ntop; i++) {
+        LockStripe* st = &lock_stripes[top[i]];
+        printf("  Stripe %4d: %llu/%llu waited, %.1f ms, last waiter %d, waits by us:", top[i],
+               (unsigned long long)atomic_load(&st->waited), (unsigned long long)atomic_load(&st->acquired),
+               (double)atomic_load(&st->wait_ns) / 1e6, atomic_load(&st->last_waiter));
+        for (int b = 0; b < LOCK_WAIT_BUCKETS; b++) {
+            uint64_t n = atomic_load(&st->wait_hist[b]);
+            if (n == 0) continue;
+            if (b < LOCK_WAIT_BUCKETS - 1) printf(" <%llu:%llu", 1ull << b, (unsigned long long)n);
+            else printf(" >=%llu:%llu", 1ull << (b - 1), (unsigned long long)n);
+        }
+        printf("\n");
+    }
+}
+
+
+// --- Function Prototypes ---
+typedef struct Session Session;
+uint32_t handle_login(int sock, Request* req, Response* res, Session** session);
+void handle_change_password(int sock, Request* req, Response* res); 
+void handle_customer_operations(int sock, Request* req, Response* res);
+void handle_employee_operations(int sock, Request* req, Response* res);
+void handle_manager_operations(int sock, Request* req, Response* res);
+void handle_admin_operations(int sock, Request* req, Response* res);
+void handle_list_page(Request* req, Response* res, int user_id, UserRole role);
+
+// --- Database Files ---
+// Each database file is opened once at startup and shared by every worker for
+// the life of the process. Records are read and written with pread/pwrite at
+// explicit offsets, so no thread depends on (or moves) a shared file position.
+// USER_FILE and ACCOUNT_FILE belong to their keyed stores, and the
+// transaction log to its segments (see below).
+static int db_loan_fd = -1;
+static int db_feedback_fd = -1;
+
+// Database syscalls made by the request this worker is running; process_request
+// adds them to the per-opcode totals.
+static __thread uint64_t db_syscalls;
+
+static ssize_t db_pread(int fd, void* buf, size_t len, off_t offset) {
+    db_syscalls++;
+    return pread(fd, buf, len, offset);
+}
+static ssize_t db_pwrite(int fd, const void* buf, size_t len, off_t offset) {
+    db_syscalls++;
+    return pwrite(fd, buf, len, offset);
+}
+// Current file size, used as the append offset while the file lock is held
+static off_t db_size(int fd) {
+    struct stat st;
+    db_syscalls++;
+    return (fstat(fd, &st) == 0) ? st.st_size : -1;
+}
+
+// Sequential reader for whole-file scans: each pread fills a block, so a scan
+// costs one syscall per block instead of one per record. Holes in sparse
+// files (USER_FILE before it was keyed) are skipped with SEEK_DATA/SEEK_HOLE;
+// the records in them are all zeroes, which every caller already ignores.
+#define SCAN_BLOCK_SIZE 65536
+typedef struct {
+    int fd;
+    size_t record_size;
+    off_t offset;     // file offset of the next block
+    off_t data_end;   // end of the data extent holding offset
+    size_t len, pos;  // bytes in block / bytes already returned
+    char block[SCAN_BLOCK_SIZE];
+} RecordScan;
+
+static void scan_begin(RecordScan* sc, int fd, size_t record_size) {
+    sc->fd = fd; sc->record_size = record_size;
+    sc->offset = 0; sc->data_end = 0; sc->len = sc->pos = 0;
+}
+// Moves offset to the first record of the next data extent. Returns 0 if the
+// rest of the file is a hole.
+static int scan_seek_data(RecordScan* sc) {
+    db_syscalls += 2;
+    off_t data = lseek(sc->fd, sc->offset, SEEK_DATA);
+    if (data == -1) {
+        if (errno == ENXIO) return 0;  // no data past offset
+        sc->data_end = (off_t)INT64_MAX; // no SEEK_DATA here: read everything
+        return 1;
+    }
+    off_t hole = lseek(sc->fd, data, SEEK_HOLE);
+    if (data > sc->offset) sc->offset = data - data % (off_t)sc->record_size;
+    sc->data_end = hole == -1 ? (off_t)INT64_MAX : hole;
+    return 1;
+}
+// Copies the next whole record into rec. Returns 0 at end of file.
+static int scan_next(RecordScan* sc, void* rec) {
+    if (sc->len - sc->pos < sc->record_size) {
+        if (sc->offset >= sc->data_end && !scan_seek_data(sc)) return 0;
+        size_t want = SCAN_BLOCK_SIZE - SCAN_BLOCK_SIZE % sc->record_size;
+        off_t extent = sc->data_end - sc->offset; // stop near the next hole
+        if (extent < (off_t)want) want = ((size_t)extent + sc->record_size - 1) / sc->record_size * sc->record_size;
+        ssize_t n = db_pread(sc->fd, sc->block, want, sc->offset);
+        if (n < (ssize_t)sc->record_size) return 0;
+        sc->len = (size_t)n - (size_t)n % sc->record_size;
+        sc->offset += (off_t)sc->len;
+        sc->pos = 0;
+    }
+    memcpy(rec, sc->block + sc->pos, sc->record_size);
+    sc->pos += sc->record_size;
+    return 1;
+}
+
+static int open_db_file(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) { perror(path); exit(EXIT_FAILURE); }
+    return fd;
+}
+static void open_databases(void) {
+    db_loan_fd = open_db_file(LOAN_FILE);
+    db_feedback_fd = open_db_file(FEEDBACK_FILE);
+}
+
+// --- Locking Helpers ---
+// A database has one server. The WAL, the transaction ID counter, the log
+// index and the log segments all live in that process, so a second server
+// would hand out the same IDs and overwrite its records; claim_database()
+// refuses to start one. Accounts are only ever touched by that server and
+// take no fcntl locks. By default other processes may still open the user,
+// loan and feedback files alongside it, so those records keep the fcntl locks
+// every process sees. With -X the server takes LOCK_FILE exclusively at
+// startup and, as the only process that can touch the files, turns these
+// helpers into no-ops. fcntl locks never exclude two threads of one process,
+// so in either mode the server's own updates to a record are serialized by
+// the lock manager stripe of its ID (and appends by the append mutexes).
+static int cfg_shared_db = 1;   // -X clears
+
+// Takes LOCK_FILE shared, or exclusively with -X, and the WAL exclusively,
+// and keeps both for the life of the process. Runs before anything in the
+// database is read, replayed or rewritten.
+static void claim_database(void) {
+    int fd = open(LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) { perror(LOCK_FILE); exit(EXIT_FAILURE); }
+    if (flock(fd, (cfg_shared_db ? LOCK_SH : LOCK_EX) | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) {
+            fprintf(stderr, "%s: database is in use by %s\n", LOCK_FILE,
+                    cfg_shared_db ? "a single-owner (-X) server" : "another server");
+        } else {
+            perror("flock");
+        }
+        exit(EXIT_FAILURE);
+    }
+    int wal_fd = open(WAL_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (wal_fd == -1) { perror(WAL_FILE); exit(EXIT_FAILURE); }
+    if (flock(wal_fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) fprintf(stderr, "%s: database is in use by another server\n", WAL_FILE);
+        else perror("flock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void set_record_lock(int fd, int record_id, int type, size_t struct_size) {
+    if (!cfg_shared_db) return;
+    struct flock lock;
+    lock.l_type = type; lock.l_whence = SEEK_SET;
+    lock.l_start = (off_t)record_id * (off_t)struct_size;
+    lock.l_len = (off_t)struct_size; lock.l_pid = getpid();
+    db_syscalls++;
+    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl set lock"); }
+}
+void unlock_record(int fd, int record_id, size_t struct_size) {
+    if (!cfg_shared_db) return;
+    struct flock lock;
+    lock.l_type = F_UNLCK; lock.l_whence = SEEK_SET;
+    lock.l_start = (off_t)record_id * (off_t)struct_size;
+    lock.l_len = (off_t)struct_size; lock.l_pid = getpid();
+    db_syscalls++;
+    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl unlock"); }
+}
+void set_file_lock(int fd, int type) {
+    if (!cfg_shared_db) return;
+    struct flock lock;
+    lock.l_type = type; lock.l_whence = SEEK_SET;
+    lock.l_start = 0; lock.l_len = 0; // Lock entire file
+    db_syscalls++;
+    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl file lock"); }
+}
+void unlock_file(int fd) {
+    if (!cfg_shared_db) return;
+    struct flock lock;
+    lock.l_type = F_UNLCK; lock.l_whence = SEEK_SET;
+    lock.l_start = 0; lock.l_len = 0;
+    db_syscalls++;
+    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl file unlock"); }
+}
+
+// --- ID Maps ---
+// Open-addressing hash tables from a record ID to its slot in a keyed store.
+// IDs are only ever added, so lookups take no lock: a writer fills in the slot
+// before it publishes the ID, and a table that gets half full is replaced by
+// a copy twice its size. Replaced tables are kept, since a reader may still
+// be probing one; together they are smaller than the current table.
+typedef struct IdMapTable {
+    uint32_t mask;                // capacity - 1; capacity is a power of two
+    struct IdMapTable* retired;   // the table this one replaced
+    struct { _Atomic int32_t id; int32_t slot; } entries[];
+} IdMapTable;
+
+typedef struct {
+    _Atomic(IdMapTable*) table;
+    int count;                    // IDs in the map; writers serialize
+} IdMap;
+
+static uint32_t idmap_hash(int32_t id) {
+    uint32_t h = (uint32_t)id * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+// Returns the slot of id, or 0 if it is not in the map.
+static int32_t idmap_get(IdMap* map, int32_t id) {
+    IdMapTable* t = atomic_load_explicit(&map->table, memory_order_acquire);
+    if (!t || id <= 0) return 0;
+    for (uint32_t i = idmap_hash(id) & t->mask;; i = (i + 1) & t->mask) {
+        int32_t k = atomic_load_explicit(&t->entries[i].id, memory_order_acquire);
+        if (k == id) return t->entries[i].slot;
+        if (k == 0) return 0;
+    }
+}
+
+static void idmap_place(IdMapTable* t, int32_t id, int32_t slot) {
+    uint32_t i = idmap_hash(id) & t->mask;
+    while (atomic_load_explicit(&t->entries[i].id, memory_order_relaxed) != 0) i = (i + 1) & t->mask;
+    t->entries[i].slot = slot;
+    atomic_store_explicit(&t->entries[i].id, id, memory_order_release);
+}
+
+// Adds id, which must not be in the map yet.
+static void idmap_put(IdMap* map, int32_t id, int32_t slot) {
+    IdMapTable* t = atomic_load_explicit(&map->table, memory_order_relaxed);
+    uint32_t cap = t ? t->mask + 1 : 0;
+    if ((uint32_t)(map->count + 1) * 2 > cap) {
+        uint32_t grown_cap = cap ? cap * 2 : 1024;
+        IdMapTable* grown = (IdMapTable*)calloc(1, sizeof(IdMapTable) + grown_cap * sizeof(grown->entries[0]));
+        if (!grown) { perror("calloc IdMap"); exit(EXIT_FAILURE); }
+        grown->mask = grown_cap - 1;
+        grown->retired = t;
+        for (uint32_t i = 0; i < cap; i++) {
+            int32_t k = atomic_load_explicit(&t->entries[i].id, memory_order_relaxed);
+            if (k != 0) idmap_place(grown, k, t->entries[i].slot);
+        }
+        atomic_store_explicit(&map->table, grown, memory_order_release);
+        t = grown;
+    }
+    idmap_place(t, id, slot);
+    map->count++;
+}
+
+// --- Keyed Stores ---
+// USER_FILE and ACCOUNT_FILE are keyed files (see KeyedFileHeader): records
+// are appended in the order they are created and found through an IdMap
+// built by scanning the file at startup. IDs are not tied to file offsets, and
+// memory grows with the number of records rather than with the largest ID.
+// Files that still hold records at id * record_size are rewritten at startup.
+//
+// Records are never moved or removed, so a slot stays valid for the life of
+// the file. Other processes may append too: appends hold the fcntl lock of
+// the header slot, and a lookup that misses first indexes whatever was
+// appended since this process last looked.
+#define KEYED_MAX_RECORDS (1 << 27) // slots reserved for per-slot arrays and mappings
+
+typedef struct {
+    const char* path;
+    size_t record_size;
+    void (*on_record)(const void* rec); // called for each record found in the file
+    int fd;
+    IdMap index;             // record ID -> slot
+    _Atomic int32_t slots;   // slots in the file, the header's included
+    pthread_mutex_t lock;    // serializes appends and index updates
+} KeyedStore;
+
+// Every keyed record starts with its int ID
+_Static_assert(offsetof(User, id) == 0 && offsetof(Account, account_id) == 0, "keyed records start with their ID");
+static int32_t keyed_record_id(const void* rec) {
+    int32_t id;
+    memcpy(&id, rec, sizeof(id));
+    return id;
+}
+
+// Zeroed memory for one value per slot, reserved up front so it never moves.
+// Only the pages that get written use memory.
+static void* reserve_per_slot(size_t value_size) {
+    void* map = mmap(NULL, (size_t)KEYED_MAX_RECORDS * value_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) { perror("mmap"); exit(EXIT_FAILURE); }
+    return map;
+}
+
+static int keyed_write_header(int fd, size_t record_size) {
+    char* slot0 = (char*)calloc(1, record_size);
+    if (!slot0) return 0;
+    KeyedFileHeader hdr = { KEYED_FILE_MAGIC, (uint32_t)record_size };
+    memcpy(slot0, &hdr, sizeof(hdr));
+    int ok = pwrite(fd, slot0, record_size, 0) == (ssize_t)record_size;
+    free(slot0);
+    return ok;
+}
+
+// Indexes the records appended since the last call, by this process or
+// another one. Called with store->lock held.
+static void keyed_catch_up(KeyedStore* store) {
+    off_t size = db_size(store->fd);
+    int32_t from = atomic_load(&store->slots);
+    if (size < (off_t)(from + 1) * (off_t)store->record_size) return;
+
+    RecordScan* scan = (RecordScan*)malloc(sizeof(RecordScan));
+    char* rec = (char*)malloc(store->record_size);
+    if (!scan || !rec) { perror("malloc"); exit(EXIT_FAILURE); }
+    scan_begin(scan, store->fd, store->record_size);
+    scan->offset = (off_t)from * (off_t)store->record_size;
+    int32_t slot = from;
+    while (slot < KEYED_MAX_RECORDS && scan_next(scan, rec)) {
+        int32_t id = keyed_record_id(rec);
+        if (id > 0 && idmap_get(&store->index, id) == 0) {
+            idmap_put(&store->index, id, slot);
+            if (store->on_record) store->on_record(rec);
+        }
+        slot++;
+    }
+    free(rec); free(scan);
+    atomic_store(&store->slots, slot);
+}
+
+// Returns the slot of record id, or 0 if there is no such record.
+static int32_t keyed_slot(KeyedStore* store, int id) {
+    if (id <= 0) return 0;
+    int32_t slot = idmap_get(&store->index, id);
+    if (slot == 0 && cfg_shared_db) { // another process may have appended it
+        pthread_mutex_lock(&store->lock);
+        keyed_catch_up(store);
+        pthread_mutex_unlock(&store->lock);
+        slot = idmap_get(&store->index, id);
+    }
+    return slot;
+}
+
+// Appends rec and indexes it. Returns its slot, or 0 if its ID is taken, the
+// store is full or the write failed.
+static int32_t keyed_append(KeyedStore* store, const void* rec) {
+    int32_t id = keyed_record_id(rec), slot = 0;
+    if (id <= 0) return 0;
+    pthread_mutex_lock(&store->lock);
+    set_record_lock(store->fd, 0, F_WRLCK, store->record_size);
+    if (cfg_shared_db) keyed_catch_up(store);
+    int32_t next = atomic_load(&store->slots);
+    if (idmap_get(&store->index, id) == 0 && next < KEYED_MAX_RECORDS) {
+        if (db_pwrite(store->fd, rec, store->record_size, (off_t)next * (off_t)store->record_size) == (ssize_t)store->record_size) {
+            idmap_put(&store->index, id, next);
+            atomic_store(&store->slots, next + 1);
+            slot = next;
+        } else {
+            perror(store->path);
+        }
+    }
+    unlock_record(store->fd, 0, store->record_size);
+    pthread_mutex_unlock(&store->lock);
+    return slot;
+}
+
+// Rewrites a file of records stored at id * record_size as a keyed file. The
+// new file is synced before it replaces the old one, so a crash leaves one or
+// the other.
+static void migrate_keyed_file(KeyedStore* store) {
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.migrate", store->path);
+    int out = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1) { perror(tmp_path); exit(EXIT_FAILURE); }
+    if (!keyed_write_header(out, store->record_size)) { perror("write keyed header"); exit(EXIT_FAILURE); }
+
+    RecordScan* scan = (RecordScan*)malloc(sizeof(RecordScan));
+    char* rec = (char*)malloc(store->record_size);
+    if (!scan || !rec) { perror("malloc"); exit(EXIT_FAILURE); }
+    scan_begin(scan, store->fd, store->record_size);
+    off_t slot = 1;
+    while (scan_next(scan, rec)) {
+        if (keyed_record_id(rec) <= 0) continue;
+        if (pwrite(out, rec, store->record_size, slot * (off_t)store->record_size) != (ssize_t)store->record_size) {
+            perror(tmp_path); exit(EXIT_FAILURE);
+        }
+        slot++;
+    }
+    free(rec); free(scan);
+
+    if (fsync(out) == -1 || rename(tmp_path, store->path) == -1) { perror(store->path); exit(EXIT_FAILURE); }
+    close(store->fd);
+    store->fd = out;
+    printf("%s: migrated %d record(s) to a keyed file.\n", store->path, (int)(slot - 1));
+}
+
+// Opens the store's file, converting it if needed, and indexes every record.
+static void keyed_open(KeyedStore* store) {
+    store->fd = open_db_file(store->path);
+    KeyedFileHeader hdr;
+    if (db_size(store->fd) == 0) {
+        if (!keyed_write_header(store->fd, store->record_size)) { perror(store->path); exit(EXIT_FAILURE); }
+    } else if (pread(store->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || hdr.magic != KEYED_FILE_MAGIC) {
+        migrate_keyed_file(store);
+    } else if (hdr.record_size != store->record_size) {
+        fprintf(stderr, "%s: records are %u bytes, expected %zu\n", store->path, hdr.record_size, store->record_size);
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&store->slots, 1);
+    pthread_mutex_lock(&store->lock);
+    keyed_catch_up(store);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// --- Account Table ---
+// ACCOUNT_FILE is a keyed store mapped MAP_SHARED at startup, so account
+// reads and updates are plain memory accesses and updates land in the page
+// cache exactly as a pwrite would. Callers still hold the account mutex. The
+// mapping reserves KEYED_MAX_RECORDS slots; appends extend the file under it.
+//
+// Only the server touches ACCOUNT_FILE, so account access takes no fcntl
+// lock and makes no locking syscall.
+//
+// Balance reads do not take the account mutex either: account_write() bumps
+// the record's version number (see version_write_begin()) and
+// account_read_optimistic() retries until it copies a record no write
+// overlapped. Readers therefore never wait for one another or hold up a
+// writer. Writers are still serialized by the account mutex.
+static KeyedStore account_store = { .path = ACCOUNT_FILE, .record_size = sizeof(Account), .fd = -1,
+                                    .lock = PTHREAD_MUTEX_INITIALIZER };
+static Account* account_table;          // indexed by slot
+static _Atomic uint32_t* account_seq;   // per slot version numbers; see version_write_begin()
+
+static void map_accounts(void) {
+    keyed_open(&account_store);
+    void* map = mmap(NULL, (size_t)KEYED_MAX_RECORDS * sizeof(Account), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_NORESERVE, account_store.fd, 0);
+    if (map == MAP_FAILED) { perror("mmap ACCOUNT_FILE"); exit(EXIT_FAILURE); }
+    account_table = (Account*)map;
+    account_seq = (_Atomic uint32_t*)reserve_per_slot(sizeof(uint32_t));
+}
+
+// Returns 0 if id has no account.
+static int account_read(int id, Account* acc) {
+    int32_t slot = keyed_slot(&account_store, id);
+    if (slot == 0) return 0;
+    *acc = account_table[slot];
+    return 1;
+}
+// Like account_read() but for callers that do not hold the account mutex.
+static int account_read_optimistic(int id, Account* acc) {
+    int32_t slot = keyed_slot(&account_store, id);
+    if (slot == 0) return 0;
+    _Atomic uint32_t* version = &account_seq[slot];
+    while (1) {
+        uint32_t seq = version_read_begin(version);
+        *acc = account_table[slot];
+        if (version_read_valid(version, seq)) return 1;
+    }
+}
+// Called with the account mutex held.
+static int account_write(int id, const Account* acc) {
+    int32_t slot = keyed_slot(&account_store, id);
+    if (slot == 0) return 0;
+    _Atomic uint32_t* version = &account_seq[slot];
+    uint32_t seq = version_write_begin(version);
+    account_table[slot] = *acc;
+    version_write_end(version, seq);
+    return 1;
+}
+
+// --- User Records ---
+// USER_FILE is a keyed store too, read and written with pread/pwrite. The
+// role index below is kept up to date with records other processes append.
+//
+// Reads are snapshot reads: user_write() bumps the record's version number
+// around its pwrite (see version_write_begin()), and readers retry any copy a
+// write overlapped instead of taking a lock. Writers hold the ID's lock
+// manager stripe (lock_account_one) as well as the fcntl record lock.
+static void user_loaded(const void* rec);
+static KeyedStore user_store = { .path = USER_FILE, .record_size = sizeof(User), .on_record = user_loaded,
+                                 .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+static _Atomic uint32_t* user_versions; // per slot
+
+static void lock_user_record(int id, int type) {
+    int32_t slot = keyed_slot(&user_store, id);
+    if (slot) set_record_lock(user_store.fd, slot, type, sizeof(User));
+}
+static void unlock_user_record(int id) {
+    int32_t slot = keyed_slot(&user_store, id);
+    if (slot) unlock_record(user_store.fd, slot, sizeof(User));
+}
+// Reads the user in slot, retrying until no write overlapped the copy.
+static int user_read_slot(int id, int32_t slot, User* user) {
+    _Atomic uint32_t* version = &user_versions[slot];
+    while (1) {
+        uint32_t seq = version_read_begin(version);
+        ssize_t got = db_pread(user_store.fd, user, sizeof(User), (off_t)slot * (off_t)sizeof(User));
+        if (version_read_valid(version, seq)) return got == (ssize_t)sizeof(User) && user->id == id;
+    }
+}
+// Returns 0 if id has no record.
+static int user_read(int id, User* user) {
+    int32_t slot = keyed_slot(&user_store, id);
+    return slot && user_read_slot(id, slot, user);
+}
+// Called with the user's stripe and record locks held.
+static void user_write(const User* user) {
+    int32_t slot = keyed_slot(&user_store, user->id);
+    if (slot == 0) return;
+    _Atomic uint32_t* version = &user_versions[slot];
+    uint32_t seq = version_write_begin(version);
+    if (db_pwrite(user_store.fd, user, sizeof(User), (off_t)slot * (off_t)sizeof(User)) != (ssize_t)sizeof(User)) {
+        perror("write USER_FILE");
+    }
+    version_write_end(version, seq);
+}
+
+// --- ID Sets ---
+// Sorted, growable arrays of record IDs, used by the in-memory indexes.
+typedef struct {
+    int32_t* ids;
+    int count, cap;
+} IdSet;
+
+static int idset_find(const IdSet* set, int32_t id) {
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (set->ids[mid] < id) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+static void idset_add(IdSet* set, int32_t id) {
+    int pos = idset_find(set, id);
+    if (pos < set->count && set->ids[pos] == id) return;
+    if (set->count == set->cap) {
+        int cap = set->cap ? set->cap * 2 : 64;
+        int32_t* grown = (int32_t*)realloc(set->ids, (size_t)cap * sizeof(int32_t));
+        if (!grown) { perror("realloc IdSet"); exit(EXIT_FAILURE); }
+        set->ids = grown; set->cap = cap;
+    }
+    memmove(&set->ids[pos + 1], &set->ids[pos], (size_t)(set->count - pos) * sizeof(int32_t));
+    set->ids[pos] = id;
+    set->count++;
+}
+static void idset_remove(IdSet* set, int32_t id) {
+    int pos = idset_find(set, id);
+    if (pos == set->count || set->ids[pos] != id) return;
+    memmove(&set->ids[pos], &set->ids[pos + 1], (size_t)(set->count - pos - 1) * sizeof(int32_t));
+    set->count--;
+}
+
+// --- Sessions ---
+// A user may hold one session at a time. Every USER_FILE slot has a Session
+// that a login claims with a compare-and-swap on its owner word, so logins and
+// disconnects never wait on each other. The owner is a token unique to the
+// login. SESSION_BUSY is set in it while the entry is being filled in or
+// expired, and only whoever set it touches the entry until it clears.
+//
+// The reactor stamps active_at on every request. A reaper thread expires
+// sessions idle for longer than -t and shuts their sockets down, so a client
+// that vanished without closing its connection (a half-open TCP connection)
+// does not keep the user locked out.
+#define SESSION_BUSY 0x80000000u
+
+struct Session {
+    _Atomic uint32_t owner;      // token of the login holding it; 0 when free
+    int fd;                      // that login's connection
+    int user_id;
+    _Atomic uint64_t active_at;  // now_ns() of its latest request
+};
+
+static Session* sessions;        // indexed by USER_FILE slot
+static _Atomic uint32_t next_session_token = 1;
+static int cfg_session_timeout = 900; // -t: seconds a session may sit idle; 0 never expires them
+
+static struct {
+    _Atomic int active;
+    _Atomic unsigned long opened, refused, expired;
+} session_stats;
+
+static void init_sessions(void) {
+    sessions = (Session*)reserve_per_slot(sizeof(Session));
+}
+
+// Returns the new session's token, or 0 if the user already has a session.
+static uint32_t session_open(int user_id, int fd, Session** session) {
+    int32_t slot = keyed_slot(&user_store, user_id);
+    if (slot == 0) return 0;
+    Session* s = &sessions[slot];
+    uint32_t token, expected = 0;
+    do token = atomic_fetch_add(&next_session_token, 1) & ~SESSION_BUSY; while (token == 0);
+    if (!atomic_compare_exchange_strong(&s->owner, &expected, token | SESSION_BUSY)) {
+        atomic_fetch_add(&session_stats.refused, 1);
+        return 0;
+    }
+    s->fd = fd;
+    s->user_id = user_id;
+    atomic_store(&s->active_at, now_ns());
+    atomic_store(&s->owner, token); // publishes fd and active_at
+    atomic_fetch_add(&session_stats.active, 1);
+    atomic_fetch_add(&session_stats.opened, 1);
+    *session = s;
+    return token;
+}
+
+// Ends the session unless the reaper already has. Returns once the reaper is
+// done with it, so the caller may then close the socket.
+static void session_close(Session* s, uint32_t token) {
+    uint32_t expected = token;
+    if (atomic_compare_exchange_strong(&s->owner, &expected, 0)) {
+        atomic_fetch_sub(&session_stats.active, 1);
+        return;
+    }
+    while (atomic_load(&s->owner) == (token | SESSION_BUSY)) sched_yield();
+}
+
+static void* session_reaper(void* arg) {
+    (void)arg;
+    uint64_t timeout = (uint64_t)cfg_session_timeout * 1000000000ull;
+    while (1) {
+        sleep(cfg_session_timeout >= 4 ? (unsigned)cfg_session_timeout / 4 : 1);
+        uint64_t now = now_ns();
+        int32_t slots = atomic_load(&user_store.slots);
+        for (int32_t slot = 1; slot < slots; slot++) {
+            Session* s = &sessions[slot];
+            uint32_t token = atomic_load(&s->owner);
+            if (token == 0 || (token & SESSION_BUSY) || atomic_load(&s->active_at) + timeout > now) continue;
+            if (!atomic_compare_exchange_strong(&s->owner, &token, token | SESSION_BUSY)) continue;
+            // session_close() waits for us, so fd is still that connection's socket
+            shutdown(s->fd, SHUT_RDWR);
+            printf("Session expired for user %d.\n", s->user_id);
+            atomic_store(&s->owner, 0);
+            atomic_fetch_sub(&session_stats.active, 1);
+            atomic_fetch_add(&session_stats.expired, 1);
+        }
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+static void start_session_reaper(void) {
+    init_sessions();
+    if (cfg_session_timeout == 0) return;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, session_reaper, NULL) != 0) {
+        perror("pthread_create"); exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+}
+
+// --- Loan Store ---
+// LOAN_FILE starts with a LoanFileHeader in slot 0, and loan n is the
+// LoanRecord in slot n. A file without the header holds the older Loan
+// records with string statuses and is rewritten in place at startup.
+//
+// The indexes below are built from the file at startup and updated by every
+// loan write. They hold loan IDs only, in ascending order, so a listing
+// reads just the records it returns.
+#define LOAN_MAGIC 0x314e4f4cu // "LON1"
+#define LOAN_LIST_MAX 20       // loans per reply to the fixed-size listing requests
+
+typedef struct {
+    uint32_t magic;
+    uint8_t reserved[sizeof(LoanRecord) - sizeof(uint32_t)];
+} LoanFileHeader;
+_Static_assert(sizeof(LoanFileHeader) == sizeof(LoanRecord), "header must fill slot 0");
+
+static struct {
+    pthread_mutex_t lock;
+    IdSet by_status[LOAN_REJECTED + 1];
+    IdSet* pending_by_assignee; // by the employee's USER_FILE slot: loans they still have to process
+    int assignees;              // entries in pending_by_assignee
+} loan_index = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char* loan_status_name(LoanStatus status) {
+    switch (status) {
+        case LOAN_PENDING:  return "PENDING";
+        case LOAN_APPROVED: return "APPROVED";
+        case LOAN_REJECTED: return "REJECTED";
+        default:            return "UNKNOWN";
+    }
+}
+
+static void loan_to_wire(const LoanRecord* rec, Loan* out) {
+    memset(out, 0, sizeof(Loan));
+    out->loan_id = rec->loan_id;
+    out->customer_id = rec->customer_id;
+    out->amount = rec->amount;
+    strncpy(out->status, loan_status_name(rec->status), sizeof(out->status) - 1);
+    out->assigned_to_employee_id = rec->assigned_to_employee_id;
+}
+
+// Updates read a loan, change it and write it back, so they hold the loan
+// ID's lock manager stripe from loan_read() to loan_write(), as well as the
+// fcntl record lock. Approving a loan also deposits into the customer's
+// account; it takes both IDs in one lock_keys() call.
+//
+// Returns 0 if loan_id has no record.
+static int loan_read(int loan_id, LoanRecord* rec) {
+    if (loan_id <= 0) return 0;
+    return db_pread(db_loan_fd, rec, sizeof(LoanRecord), (off_t)loan_id * (off_t)sizeof(LoanRecord)) == (ssize_t)sizeof(LoanRecord) &&
+           rec->loan_id == loan_id;
+}
+static void loan_write(const LoanRecord* rec) {
+    if (db_pwrite(db_loan_fd, rec, sizeof(LoanRecord), (off_t)rec->loan_id * (off_t)sizeof(LoanRecord)) != (ssize_t)sizeof(LoanRecord)) {
+        perror("write LOAN_FILE");
+    }
+}
+
+// Called with loan_index.lock held.
+static IdSet* loan_assignee_set(LoanStatus status, int emp_id) {
+    if (status != LOAN_PENDING) return NULL;
+    int32_t slot = keyed_slot(&user_store, emp_id);
+    if (slot == 0) return NULL;
+    if (slot >= loan_index.assignees) {
+        int n = slot + 1 > 2 * loan_index.assignees ? slot + 1 : 2 * loan_index.assignees;
+        IdSet* grown = (IdSet*)realloc(loan_index.pending_by_assignee, (size_t)n * sizeof(IdSet));
+        if (!grown) { perror("realloc loan index"); exit(EXIT_FAILURE); }
+        memset(&grown[loan_index.assignees], 0, (size_t)(n - loan_index.assignees) * sizeof(IdSet));
+        loan_index.pending_by_assignee = grown;
+        loan_index.assignees = n;
+    }
+    return &loan_index.pending_by_assignee[slot];
+}
+
+// Moves a loan from its old state to rec. old is NULL for a new loan.
+static void loan_index_update(const LoanRecord* old, const LoanRecord* rec) {
+    pthread_mutex_lock(&loan_index.lock);
+    if (old) {
+        if (old->status >= LOAN_PENDING && old->status <= LOAN_REJECTED) idset_remove(&loan_index.by_status[old->status], old->loan_id);
+        IdSet* set = loan_assignee_set(old->status, old->assigned_to_employee_id);
+        if (set) idset_remove(set, old->loan_id);
+    }
+    if (rec->status >= LOAN_PENDING && rec->status <= LOAN_REJECTED) idset_add(&loan_index.by_status[rec->status], rec->loan_id);
+    IdSet* set = loan_assignee_set(rec->status, rec->assigned_to_employee_id);
+    if (set) idset_add(set, rec->loan_id);
+    pthread_mutex_unlock(&loan_index.lock);
+}
+
+// Copies up to max IDs from set that come after *cursor, the last ID of the
+// previous page. *cursor becomes this page's last ID, or 0 if nothing
+// follows it. Returns the number copied.
+static int idset_page(const IdSet* set, uint64_t* cursor, int32_t* ids, int max) {
+    int start = *cursor >= (uint64_t)INT32_MAX ? set->count : idset_find(set, (int32_t)*cursor + 1);
+    int n = set->count - start < max ? set->count - start : max;
+    if (n > 0) memcpy(ids, &set->ids[start], (size_t)n * sizeof(int32_t));
+    *cursor = (n > 0 && start + n < set->count) ? (uint64_t)ids[n - 1] : 0;
+    return n;
+}
+
+// Fills out with up to max pending loans, lowest ID first, starting after
+// *cursor (see idset_page). emp_id 0 lists every pending loan. A loan
+// processed since the index was read is skipped. Returns the number listed;
+// *total, if given, gets the number of pending loans less the skipped ones.
+static int list_pending_loans(int emp_id, uint64_t* cursor, Loan* out, int max, int* total) {
+    int32_t ids[MAX_PAGE_ROWS];
+    if (max > MAX_PAGE_ROWS) max = MAX_PAGE_ROWS;
+    pthread_mutex_lock(&loan_index.lock);
+    const IdSet* set = emp_id == 0 ? &loan_index.by_status[LOAN_PENDING] : loan_assignee_set(LOAN_PENDING, emp_id);
+    int pending = 0, n = 0;
+    if (set) {
+        pending = set->count;
+        n = idset_page(set, cursor, ids, max);
+    } else {
+        *cursor = 0;
+    }
+    pthread_mutex_unlock(&loan_index.lock);
+
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        LoanRecord rec;
+        if (!loan_read(ids[i], &rec) || rec.status != LOAN_PENDING) continue;
+        if (emp_id != 0 && rec.assigned_to_employee_id != emp_id) continue;
+        loan_to_wire(&rec, &out[count++]);
+    }
+    if (total) *total = pending - (n - count);
+    return count;
+}
+
+// Rewrites a LOAN_FILE of Loan records as LoanRecords behind a header. The new
+// file is synced before it replaces the old one, so a crash leaves one or the
+// other.
+static void migrate_loan_file(void) {
+    const char* tmp_path = LOAN_FILE ".migrate";
+    int out = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1) { perror(tmp_path); exit(EXIT_FAILURE); }
+
+    LoanFileHeader hdr = { LOAN_MAGIC, {0} };
+    if (pwrite(out, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) { perror("write loan header"); exit(EXIT_FAILURE); }
+
+    RecordScan* scan = (RecordScan*)malloc(sizeof(RecordScan));
+    if (!scan) { perror("malloc"); exit(EXIT_FAILURE); }
+    scan_begin(scan, db_loan_fd, sizeof(Loan));
+    Loan loan;
+    int migrated = 0;
+    while (scan_next(scan, &loan)) {
+        if (loan.loan_id <= 0) continue;
+        LoanRecord rec = { loan.loan_id, loan.customer_id, loan.amount, LOAN_REJECTED, loan.assigned_to_employee_id };
+        // Anything but PENDING or APPROVED was never actionable, as before
+        if (strncmp(loan.status, "PENDING", sizeof(loan.status)) == 0) rec.status = LOAN_PENDING;
+        else if (strncmp(loan.status, "APPROVED", sizeof(loan.status)) == 0) rec.status = LOAN_APPROVED;
+        if (pwrite(out, &rec, sizeof(rec), (off_t)rec.loan_id * (off_t)sizeof(LoanRecord)) != (ssize_t)sizeof(rec)) {
+            perror("write migrated LOAN_FILE"); exit(EXIT_FAILURE);
+        }
+        migrated++;
+    }
+    free(scan);
+
+    if (fsync(out) == -1 || rename(tmp_path, LOAN_FILE) == -1) { perror("replace LOAN_FILE"); exit(EXIT_FAILURE); }
+    close(db_loan_fd);
+    db_loan_fd = out;
+    printf("Loan database: migrated %d record(s) to the compact format.\n", migrated);
+}
+
+// Checks the LOAN_FILE format and builds the indexes.
+static void load_loans(void) {
+    off_t size = db_size(db_loan_fd);
+    LoanFileHeader hdr;
+    if (size == 0) {
+        LoanFileHeader fresh = { LOAN_MAGIC, {0} };
+        if (pwrite(db_loan_fd, &fresh, sizeof(fresh), 0) != (ssize_t)sizeof(fresh)) { perror("write loan header"); exit(EXIT_FAILURE); }
+    } else if (pread(db_loan_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || hdr.magic != LOAN_MAGIC) {
+        migrate_loan_file();
+    }
+
+    RecordScan* scan = (RecordScan*)malloc(sizeof(RecordScan));
+    if (!scan) { perror("malloc"); exit(EXIT_FAILURE); }
+    scan_begin(scan, db_loan_fd, sizeof(LoanRecord));
+    scan->offset = (off_t)sizeof(LoanRecord);
+    LoanRecord rec;
+    while (scan_next(scan, &rec)) {
+        if (rec.loan_id > 0) loan_index_update(NULL, &rec);
+    }
+    free(scan);
+}
+
+// --- User ID Allocator ---
+// Each role has a range of IDs below ROLE_RANGE_END, tracked with one bit per
+// ID, set while the ID is in use. A new user takes the first clear bit in its
+// role's range with a compare-and-swap, so adding a user probes at most 16
+// words and takes no file lock. Once the range is full, users of every role
+// take IDs from ROLE_RANGE_END up, from a shared counter kept after the bitmap.
+// Both are a MAP_SHARED mapping of USERID_FILE. USER_FILE stays the source of
+// truth: load_users() checks the mapping against it at startup, which frees
+// any ID reserved by a request that never wrote its record.
+#define ROLE_RANGE_END 5000
+#define USERID_WORDS ((ROLE_RANGE_END + 63) / 64)
+
+static _Atomic uint64_t* user_id_map;   // USERID_WORDS bitmap words, then the next shared ID
+
+static int role_id_range(UserRole role, int* first, int* last) {
+    switch (role) {
+        case CUSTOMER: *first = 1001; *last = 1999; return 1;
+        case EMPLOYEE: *first = 2001; *last = 2999; return 1;
+        case MANAGER:  *first = 3001; *last = 3999; return 1;
+        case ADMIN:    *first = 4001; *last = 4999; return 1;
+        default:       return 0;
+    }
+}
+
+// Returns the lowest free ID in role's range, now marked used, or 0 if the
+// range is full.
+static int user_id_alloc(UserRole role) {
+    int first, last;
+    if (!role_id_range(role, &first, &last)) return 0;
+    for (int w = first / 64; w <= last / 64; w++) {
+        uint64_t mask = ~0ull;
+        if (w == first / 64) mask &= ~0ull << (first % 64);
+        if (w == last / 64) mask &= ~0ull >> (63 - last % 64);
+        uint64_t bits = atomic_load(&user_id_map[w]);
+        while ((~bits & mask) != 0) {
+            int b = __builtin_ctzll(~bits & mask);
+            if (atomic_compare_exchange_weak(&user_id_map[w], &bits, bits | (1ull << b))) return w * 64 + b;
+        }
+    }
+    uint64_t id = atomic_fetch_add(&user_id_map[USERID_WORDS], 1);
+    return id <= INT32_MAX ? (int)id : 0;
+}
+
+// Returns an ID from user_id_alloc() whose record could not be written.
+static void user_id_free(int id) {
+    if (id < ROLE_RANGE_END) {
+        atomic_fetch_and(&user_id_map[id / 64], ~(1ull << (id % 64)));
+    } else {
+        // Only the latest shared ID can be handed back; an earlier one is
+        // reclaimed when load_users() next rebuilds the counter
+        uint64_t next = (uint64_t)id + 1;
+        atomic_compare_exchange_strong(&user_id_map[USERID_WORDS], &next, (uint64_t)id);
+    }
+}
+
+// Maps USERID_FILE and makes it match used, the bitmap of role-range IDs with
+// records, and next_id, the ID after the highest one in use. Rewriting the map
+// is safe only because no other process allocates from it: the server holds
+// the database's WAL lock (see claim_database()) from before this runs.
+static void map_user_ids(const uint64_t* used, uint64_t next_id) {
+    int fd = open(USERID_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) { perror(USERID_FILE); exit(EXIT_FAILURE); }
+    size_t bytes = (USERID_WORDS + 1) * sizeof(uint64_t);
+    int created = db_size(fd) == 0; // by init_db or a first run: nothing to correct
+    if (ftruncate(fd, (off_t)bytes) == -1) { perror("ftruncate USERID_FILE"); exit(EXIT_FAILURE); }
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { perror("mmap USERID_FILE"); exit(EXIT_FAILURE); }
+    close(fd);
+    user_id_map = (_Atomic uint64_t*)map;
+
+    int repaired = 0;
+    for (int w = 0; w < USERID_WORDS; w++) {
+        uint64_t bits = atomic_load(&user_id_map[w]);
+        if (bits == used[w]) continue;
+        repaired += __builtin_popcountll(bits ^ used[w]);
+        atomic_store(&user_id_map[w], used[w]);
+    }
+    atomic_store(&user_id_map[USERID_WORDS], next_id > ROLE_RANGE_END ? next_id : ROLE_RANGE_END);
+    if (repaired > 0 && !created) printf("User ID map: corrected %d ID(s) from USER_FILE.\n", repaired);
+}
+
+// --- User Role Index ---
+// The IDs of every user by role, built from USER_FILE at startup and updated
+// when a user is added or an admin changes a role. Listings read only the
+// records they return, with one pread per run of adjacent slots. The active
+// flag is not indexed; listings include inactive users, as they always have.
+static struct {
+    pthread_mutex_t lock;
+    IdSet by_role[ADMIN + 1];
+} user_index = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int valid_role(UserRole role) {
+    return role >= CUSTOMER && role <= ADMIN;
+}
+
+// Moves id from old_role to role. Pass 0 for a role the user does not have.
+static void user_index_update(int id, UserRole old_role, UserRole role) {
+    if (id <= 0) return;
+    pthread_mutex_lock(&user_index.lock);
+    if (valid_role(old_role)) idset_remove(&user_index.by_role[old_role], id);
+    if (valid_role(role)) idset_add(&user_index.by_role[role], id);
+    pthread_mutex_unlock(&user_index.lock);
+}
+
+// Fills out with up to max users of role, lowest ID first, starting after
+// *cursor (see idset_page). Returns the number listed; *total, if given, gets
+// the number of users with the role less any whose role just changed.
+static int list_users(UserRole role, uint64_t* cursor, User* out, int max, int* total) {
+    if (!valid_role(role)) { *cursor = 0; if (total) *total = 0; return 0; }
+    int32_t ids[MAX_PAGE_ROWS];
+    if (max > MAX_PAGE_ROWS) max = MAX_PAGE_ROWS;
+    pthread_mutex_lock(&user_index.lock);
+    int users = user_index.by_role[role].count;
+    int n = idset_page(&user_index.by_role[role], cursor, ids, max);
+    pthread_mutex_unlock(&user_index.lock);
+
+    // Users are appended as they are created, so consecutive IDs are
+    // usually in adjacent slots
+    int32_t slots[MAX_PAGE_ROWS];
+    for (int i = 0; i < n; i++) slots[i] = keyed_slot(&user_store, ids[i]);
+
+    int count = 0;
+    for (int i = 0; i < n; ) {
+        int run = 1;
+        if (slots[i] == 0) { i++; continue; }
+        while (i + run < n && slots[i + run] == slots[i] + run) run++;
+        // out has room for the whole run, so read straight into it. A record
+        // that a write overlapped is read again on its own.
+        int base = count;
+        uint32_t seqs[MAX_PAGE_ROWS];
+        for (int j = 0; j < run; j++) seqs[j] = version_read_begin(&user_versions[slots[i + j]]);
+        ssize_t got = db_pread(user_store.fd, &out[base], (size_t)run * sizeof(User), (off_t)slots[i] * (off_t)sizeof(User));
+        int whole = got > 0 ? (int)(got / (ssize_t)sizeof(User)) : 0;
+        for (int j = 0; j < whole; j++) {
+            User* u = &out[base + j];
+            if (!version_read_valid(&user_versions[slots[i + j]], seqs[j]) &&
+                !user_read_slot(ids[i + j], slots[i + j], u)) continue;
+            // A user whose role changed since the index was read is dropped
+            if (u->id == ids[i + j] && u->role == role) out[count++] = *u;
+        }
+        i += run;
+    }
+    if (total) *total = users - (n - count);
+    return count;
+}
+
+// Indexes a user found in USER_FILE: at startup, or appended by another process.
+static void user_loaded(const void* rec) {
+    const User* user = (const User*)rec;
+    user_index_update(user->id, 0, user->role);
+}
+
+// Opens USER_FILE, which builds the role index, then checks the ID map against it.
+static void load_users(void) {
+    user_versions = (_Atomic uint32_t*)reserve_per_slot(sizeof(uint32_t));
+    keyed_open(&user_store);
+    uint64_t used[USERID_WORDS] = {0};
+    uint64_t next_id = 0;
+    pthread_mutex_lock(&user_index.lock);
+    for (int role = CUSTOMER; role <= ADMIN; role++) {
+        const IdSet* set = &user_index.by_role[role];
+        for (int i = 0; i < set->count && set->ids[i] < ROLE_RANGE_END; i++) {
+            used[set->ids[i] / 64] |= 1ull << (set->ids[i] % 64);
+        }
+        if (set->count > 0 && (uint64_t)set->ids[set->count - 1] >= next_id) next_id = (uint64_t)set->ids[set->count - 1] + 1;
+    }
+    pthread_mutex_unlock(&user_index.lock);
+    map_user_ids(used, next_id);
+}
+
+// --- Packed Segments ---
+// Archived segments are stored as TXPACK_FILE (see TxPackHeader), about a
+// sixth the size of the raw records. Each block starts from zero state and
+// stores every record as a flags byte followed by
+//   type       its TxType in the flags; TX_TYPE_OTHER adds a length byte and the string
+//   account    zigzag varint of the change from the previous record's
+//   timestamp  zigzag varint of the change from the previous record's
+//   amount     zigzag varint of whole cents, or the raw double (TXPACK_RAW_AMOUNT)
+//   balance    likewise (TXPACK_RAW_BALANCE)
+// The ID is implied by the record's position. A record that was never written
+// is one TXPACK_HOLE byte. Anything the encoding would not reproduce byte for
+// byte is stored whole after a TXPACK_RAW byte, so packing is lossless.
+#define TXPACK_TYPE_MASK 0x07      // 0: literal type string
+#define TXPACK_RAW_AMOUNT 0x08
+#define TXPACK_RAW_BALANCE 0x10
+#define TXPACK_HOLE 0x40
+#define TXPACK_RAW 0x80
+#define TXPACK_MAX_RECORD (1 + sizeof(Transaction))
+
+// Indexed by TxType - 1; the type code in a packed record is the TxType
+static const char* const tx_type_names[TX_TYPE_COUNT - 1] = { "DEPOSIT", "WITHDRAW", "TRANSFER_OUT", "TRANSFER_IN", "LOAN_DEPOSIT" };
+#define TXPACK_TYPES (TX_TYPE_COUNT - 1)
+
+typedef struct {
+    int32_t account;
+    int64_t timestamp;
+} TxPackState;
+
+static inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+static uint8_t* put_varint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) { *p++ = (uint8_t)v | 0x80; v >>= 7; }
+    *p++ = (uint8_t)v;
+    return p;
+}
+// Returns the byte after the varint, or NULL if it runs past end.
+static inline const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t* v) {
+    if (p < end && *p < 0x80) { *v = *p; return p + 1; } // deltas mostly fit one byte
+    uint64_t x = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { *v = x; return p; }
+    }
+    return NULL;
+}
+
+// Whole cents that convert back to exactly v, or 0.
+static int to_cents(double v, int64_t* cents) {
+    double c = v * 100.0;
+    if (!(c > -9e15 && c < 9e15)) return 0;
+    *cents = (int64_t)(c < 0 ? c - 0.5 : c + 0.5);
+    return (double)*cents / 100.0 == v;
+}
+
+static const uint8_t* txpack_get(const uint8_t* p, const uint8_t* end, int32_t id, TxPackState* st, Transaction* tx) {
+    if (p >= end) return NULL;
+    uint8_t flags = *p++;
+    memset(tx, 0, sizeof(*tx));
+    if (flags & TXPACK_HOLE) return p;
+    if (flags & TXPACK_RAW) {
+        if ((size_t)(end - p) < sizeof(Transaction)) return NULL;
+        memcpy(tx, p, sizeof(Transaction));
+        return p + sizeof(Transaction);
+    }
+    tx->transaction_id = id;
+    int type = flags & TXPACK_TYPE_MASK;
+    if (type == 0) {
+        if (p >= end || *p >= sizeof(tx->type) || end - p <= *p) return NULL;
+        memcpy(tx->type, p + 1, *p);
+        p += 1 + *p;
+    } else if (type <= TXPACK_TYPES) {
+        strcpy(tx->type, tx_type_names[type - 1]);
+    } else {
+        return NULL;
+    }
+    uint64_t v;
+    if (!(p = get_varint(p, end, &v))) return NULL;
+    st->account = (int32_t)((int64_t)st->account + unzigzag(v));
+    tx->account_id = st->account;
+    if (!(p = get_varint(p, end, &v))) return NULL;
+    st->timestamp += unzigzag(v);
+    tx->timestamp = (time_t)st->timestamp;
+    double* values[2] = { &tx->amount, &tx->new_balance };
+    for (int i = 0; i < 2; i++) {
+        if (flags & (i == 0 ? TXPACK_RAW_AMOUNT : TXPACK_RAW_BALANCE)) {
+            if ((size_t)(end - p) < sizeof(double)) return NULL;
+            memcpy(values[i], p, sizeof(double));
+            p += sizeof(double);
+        } else {
+            if (!(p = get_varint(p, end, &v))) return NULL;
+            *values[i] = (double)unzigzag(v) / 100.0;
+        }
+    }
+    return p;
+}
+
+// Appends tx at p, which has room for TXPACK_MAX_RECORD bytes.
+static uint8_t* txpack_put(uint8_t* p, const Transaction* tx, int32_t id, TxPackState* st) {
+    static const Transaction zero;
+    if (memcmp(tx, &zero, sizeof(zero)) == 0) { *p++ = TXPACK_HOLE; return p; }
+
+    uint8_t* start = p;
+    TxPackState before = *st;
+    uint8_t flags = 0;
+    size_t len = strnlen(tx->type, sizeof(tx->type));
+    for (int i = 0; i < TXPACK_TYPES; i++) {
+        if (strcmp(tx->type, tx_type_names[i]) == 0 && len < sizeof(tx->type)) flags = (uint8_t)(i + 1);
+    }
+    int64_t amount = 0, balance = 0;
+    if (!to_cents(tx->amount, &amount)) flags |= TXPACK_RAW_AMOUNT;
+    if (!to_cents(tx->new_balance, &balance)) flags |= TXPACK_RAW_BALANCE;
+    *p++ = flags;
+    if ((flags & TXPACK_TYPE_MASK) == 0) {
+        *p++ = (uint8_t)(len < sizeof(tx->type) ? len : 0);
+        memcpy(p, tx->type, p[-1]);
+        p += p[-1];
+    }
+    p = put_varint(p, zigzag((int64_t)tx->account_id - st->account));
+    p = put_varint(p, zigzag((int64_t)tx->timestamp - st->timestamp));
+    st->account = tx->account_id;
+    st->timestamp = (int64_t)tx->timestamp;
+    if (flags & TXPACK_RAW_AMOUNT) { memcpy(p, &tx->amount, sizeof(double)); p += sizeof(double); }
+    else p = put_varint(p, zigzag(amount));
+    if (flags & TXPACK_RAW_BALANCE) { memcpy(p, &tx->new_balance, sizeof(double)); p += sizeof(double); }
+    else p = put_varint(p, zigzag(balance));
+
+    // Keep the encoding only if it decodes to the same bytes
+    Transaction check;
+    TxPackState replay = before;
+    if (p - start <= (ptrdiff_t)TXPACK_MAX_RECORD &&
+        txpack_get(start, p, id, &replay, &check) == p && memcmp(&check, tx, sizeof(check)) == 0) {
+        return p;
+    }
+    *st = before;
+    *start = TXPACK_RAW;
+    memcpy(start + 1, tx, sizeof(Transaction));
+    return start + TXPACK_MAX_RECORD;
+}
+
+// Packs the records of segment n (IDs first_id onwards). Returns a malloc'd
+// file image and sets *size.
+static uint8_t* txpack_encode(uint32_t n, int32_t first_id, const Transaction* recs, uint32_t records, size_t* size) {
+    uint32_t blocks = (records + TXPACK_BLOCK_RECORDS - 1) / TXPACK_BLOCK_RECORDS;
+    size_t head = sizeof(TxPackHeader) + ((size_t)blocks + 1) * sizeof(uint32_t);
+    uint8_t* out = (uint8_t*)malloc(head + (size_t)records * TXPACK_MAX_RECORD);
+    if (!out) return NULL;
+    TxPackHeader hdr = { TXPACK_MAGIC, n, records, blocks };
+    memcpy(out, &hdr, sizeof(hdr));
+    uint32_t* offsets = (uint32_t*)(out + sizeof(hdr));
+    uint8_t* p = out + head;
+    for (uint32_t b = 0; b < blocks; b++) {
+        offsets[b] = (uint32_t)(p - out);
+        TxPackState st = { 0, 0 };
+        for (uint32_t i = b * TXPACK_BLOCK_RECORDS; i < records && i < (b + 1) * TXPACK_BLOCK_RECORDS; i++) {
+            p = txpack_put(p, &recs[i], first_id + (int32_t)i, &st);
+        }
+    }
+    offsets[blocks] = (uint32_t)(p - out);
+    *size = (size_t)(p - out);
+    return out;
+}
+
+// Checks a mapped pack file's header and block offsets.
+static int txpack_valid(const uint8_t* pack, size_t size, uint32_t n, uint32_t records) {
+    const TxPackHeader* hdr = (const TxPackHeader*)pack;
+    if (size < sizeof(*hdr) || hdr->magic != TXPACK_MAGIC || hdr->segment != n || hdr->records != records ||
+        hdr->blocks != (records + TXPACK_BLOCK_RECORDS - 1) / TXPACK_BLOCK_RECORDS ||
+        size < sizeof(*hdr) + ((size_t)hdr->blocks + 1) * sizeof(uint32_t)) return 0;
+    const uint32_t* offsets = (const uint32_t*)(hdr + 1);
+    for (uint32_t b = 0; b < hdr->blocks; b++) {
+        if (offsets[b] > offsets[b + 1]) return 0;
+    }
+    return offsets[hdr->blocks] <= size;
+}
+
+// The block this thread decoded last; history walks mostly stay in one.
+static __thread struct {
+    const uint8_t* pack;
+    uint32_t block;
+    int count;
+    Transaction recs[TXPACK_BLOCK_RECORDS];
+} txpack_block;
+
+// Copies up to max records starting at index, stopping at the end of the
+// block. Returns the number copied, 0 if the block is corrupt.
+static int txpack_copy(const uint8_t* pack, uint32_t index, Transaction* out, int max) {
+    const TxPackHeader* hdr = (const TxPackHeader*)pack;
+    uint32_t block = index / TXPACK_BLOCK_RECORDS;
+    if (txpack_block.pack != pack || txpack_block.block != block) {
+        const uint32_t* offsets = (const uint32_t*)(hdr + 1);
+        const uint8_t* p = pack + offsets[block], *end = pack + offsets[block + 1];
+        uint32_t first = block * TXPACK_BLOCK_RECORDS;
+        int count = (int)(hdr->records - first < TXPACK_BLOCK_RECORDS ? hdr->records - first : TXPACK_BLOCK_RECORDS);
+        int32_t first_id = (int32_t)((uint64_t)hdr->segment * hdr->records + first + 1);
+        TxPackState st = { 0, 0 };
+        int i = 0;
+        while (i < count && (p = txpack_get(p, end, first_id + i, &st, &txpack_block.recs[i]))) i++;
+        if (i < count) {
+            fprintf(stderr, "Transaction segment %u: block %u is corrupt.\n", hdr->segment, block);
+            txpack_block.pack = NULL;
+            return 0;
+        }
+        txpack_block.pack = pack; txpack_block.block = block; txpack_block.count = count;
+    }
+    int from = (int)(index % TXPACK_BLOCK_RECORDS);
+    if (max > txpack_block.count - from) max = txpack_block.count - from;
+    memcpy(out, &txpack_block.recs[from], (size_t)max * sizeof(Transaction));
+    return max;
+}
+
+// --- Transaction Segments ---
+// The transaction log is split into fixed-size segment files listed by
+// TXMANIFEST_FILE (see TxManifest). Records are appended to the tail segment
+// with pwrite. A full segment is sealed: synced, made read-only and mapped, so
+// every later read of it is a memory copy. History walks newest-first, so
+// recent history only touches the tail and the last few sealed segments.
+//
+// With -a N only the newest N sealed segments stay in the data directory;
+// an archiver thread packs older ones into TXARCHIVE_DIR (see Packed
+// Segments) without holding up the logger.
+// IDs stay as they were; an archived segment is opened from there if a read
+// still needs it, and a history that reaches one that was taken away just
+// ends early.
+#define TXSEGMENT_MAX_ID INT32_MAX
+#define TXSEGMENT_READ_RUN 4096   // records per read when scanning
+
+typedef struct TxColumns TxColumns;
+typedef struct {
+    _Atomic int fd;                    // -1 until opened, and once packed
+    _Atomic(const Transaction*) map;   // sealed segments only; NULL once packed
+    _Atomic(const uint8_t*) pack;      // archived segments
+    _Atomic int readers;               // in txseg_read_run()
+    TxColumns* columns;                // see Transaction Analytics
+} TxSegment;
+
+static struct {
+    TxManifest manifest;       // as last written; changed under txlog_mutex
+    uint32_t records;          // per segment
+    size_t bytes;              // per segment
+    TxSegment* segs;           // indexed by segment number
+    _Atomic uint32_t tail;
+    pthread_mutex_t open_lock; // opening sealed segments on first use
+    uint64_t packed_records, packed_bytes; // archived by this process
+} txlog_segments = { .open_lock = PTHREAD_MUTEX_INITIALIZER };
+static int cfg_live_segments = 0; // -a: sealed segments kept out of TXARCHIVE_DIR; 0 keeps all
+
+static void txseg_path(char* path, size_t size, uint32_t n, int archived) {
+    char name[64];
+    snprintf(name, sizeof(name), TXSEGMENT_FILE, n);
+    if (archived) snprintf(path, size, "%s/%s", TXARCHIVE_DIR, name);
+    else snprintf(path, size, "%s", name);
+}
+static void txpack_path(char* path, size_t size, uint32_t n) {
+    char name[64];
+    snprintf(name, sizeof(name), TXPACK_FILE, n);
+    snprintf(path, size, "%s/%s", TXARCHIVE_DIR, name);
+}
+static inline uint32_t txseg_of(int32_t id) { return (uint32_t)(id - 1) / txlog_segments.records; }
+static inline uint32_t txseg_index(int32_t id) { return (uint32_t)(id - 1) % txlog_segments.records; }
+
+static void txseg_write_manifest(void) {
+    const char* tmp_path = TXMANIFEST_FILE ".tmp";
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 ||
+        write(fd, &txlog_segments.manifest, sizeof(TxManifest)) != (ssize_t)sizeof(TxManifest) ||
+        fdatasync(fd) == -1 || rename(tmp_path, TXMANIFEST_FILE) == -1) {
+        perror("write TXMANIFEST_FILE");
+    }
+    if (fd != -1) close(fd);
+}
+
+// Opens segment n from the data directory or, failing that, the archive.
+static int txseg_open_file(uint32_t n, int flags) {
+    char path[128];
+    txseg_path(path, sizeof(path), n, 0);
+    int fd = open(path, flags | O_CLOEXEC, 0644);
+    if (fd == -1 && errno == ENOENT && !(flags & O_CREAT)) {
+        txseg_path(path, sizeof(path), n, 1);
+        fd = open(path, flags | O_CLOEXEC);
+    }
+    return fd;
+}
+
+// Maps the pack of segment n. Called under open_lock.
+static int txseg_open_pack(uint32_t n) {
+    char path[128];
+    txpack_path(path, sizeof(path), n);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    off_t size = db_size(fd);
+    void* m = size > 0 ? mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (m == MAP_FAILED) { perror(path); return 0; }
+    if (!txpack_valid((const uint8_t*)m, (size_t)size, n, txlog_segments.records)) {
+        fprintf(stderr, "%s: not a packed transaction segment\n", path);
+        munmap(m, (size_t)size);
+        return 0;
+    }
+    atomic_store_explicit(&txlog_segments.segs[n].pack, (const uint8_t*)m, memory_order_release);
+    return 1;
+}
+
+// Opens sealed segment n on first use: its raw file, in the data directory
+// or archived by an older server, else its pack. Returns 0 if neither is
+// there.
+static int txseg_open_sealed(uint32_t n) {
+    TxSegment* seg = &txlog_segments.segs[n];
+    if (atomic_load_explicit(&seg->map, memory_order_acquire) ||
+        atomic_load_explicit(&seg->pack, memory_order_acquire)) return 1;
+    pthread_mutex_lock(&txlog_segments.open_lock);
+    int ok = atomic_load(&seg->map) || atomic_load(&seg->pack);
+    if (!ok) {
+        int fd = atomic_load(&seg->fd);
+        if (fd == -1) fd = txseg_open_file(n, O_RDONLY);
+        if (fd != -1) {
+            void* m = mmap(NULL, txlog_segments.bytes, PROT_READ, MAP_SHARED, fd, 0);
+            if (m == MAP_FAILED) perror("mmap transaction segment");
+            else ok = 1;
+            atomic_store(&seg->fd, fd);
+            if (ok) atomic_store_explicit(&seg->map, (const Transaction*)m, memory_order_release);
+        } else {
+            ok = txseg_open_pack(n);
+        }
+    }
+    pthread_mutex_unlock(&txlog_segments.open_lock);
+    return ok;
+}
+
+// Reads up to max consecutive records starting at ID first, stopping at the
+// end of its segment. Returns the number read.
+static int txseg_read_run(int32_t first, Transaction* out, int max) {
+    uint32_t n = txseg_of(first), index = txseg_index(first);
+    if (n > atomic_load(&txlog_segments.tail)) return 0;
+    if ((uint32_t)max > txlog_segments.records - index) max = (int)(txlog_segments.records - index);
+    if (n < atomic_load(&txlog_segments.tail) && !txseg_open_sealed(n)) return 0;
+
+    // Packing a segment frees its raw file once no reader is in here
+    TxSegment* seg = &txlog_segments.segs[n];
+    atomic_fetch_add(&seg->readers, 1);
+    const Transaction* map = atomic_load(&seg->map);
+    const uint8_t* pack = atomic_load(&seg->pack);
+    int got = 0;
+    if (map) {
+        memcpy(out, &map[index], (size_t)max * sizeof(Transaction));
+        got = max;
+    } else if (pack) {
+        got = txpack_copy(pack, index, out, max);
+    } else {
+        // The tail; if it was sealed meanwhile its descriptor still reads it
+        ssize_t len = db_pread(atomic_load(&seg->fd), out, (size_t)max * sizeof(Transaction),
+                               (off_t)index * (off_t)sizeof(Transaction));
+        got = len > 0 ? (int)(len / (ssize_t)sizeof(Transaction)) : 0;
+    }
+    atomic_fetch_sub(&seg->readers, 1);
+    return got;
+}
+static int txseg_read(int32_t id, Transaction* tx) {
+    return id > 0 && txseg_read_run(id, tx, 1) == 1;
+}
+
+// The first ID from id to last, within id's segment, whose record is written,
+// copying the record to *tx; 0 if there is none. Holes cost no copying: a
+// mapped segment is checked in place, a packed block that its offsets show to
+// be all TXPACK_HOLE bytes is passed over whole, and the tail is only read up
+// to its file size.
+static int32_t txseg_next_written(int32_t id, int32_t last, Transaction* tx) {
+    uint32_t n = txseg_of(id), index = txseg_index(id), end = txlog_segments.records;
+    if (n > atomic_load(&txlog_segments.tail)) return 0;
+    if (n < atomic_load(&txlog_segments.tail) && !txseg_open_sealed(n)) return 0;
+    int32_t first_id = (int32_t)((uint64_t)n * txlog_segments.records + 1);
+    if ((int64_t)last - first_id + 1 < (int64_t)end) end = (uint32_t)(last - first_id + 1);
+
+    TxSegment* seg = &txlog_segments.segs[n];
+    atomic_fetch_add(&seg->readers, 1);
+    const Transaction* map = atomic_load(&seg->map);
+    const uint8_t* pack = atomic_load(&seg->pack);
+    int32_t found = 0;
+    if (map) {
+        for (; index < end && !found; index++) {
+            if (map[index].transaction_id == first_id + (int32_t)index) { *tx = map[index]; found = first_id + (int32_t)index; }
+        }
+    } else {
+        const uint32_t* offsets = pack ? (const uint32_t*)((const TxPackHeader*)pack + 1) : NULL;
+        if (!pack) {
+            // The tail; if it was sealed meanwhile its descriptor still reads it
+            off_t written = db_size(atomic_load(&seg->fd)) / (off_t)sizeof(Transaction);
+            if (written < (off_t)end) end = (uint32_t)written;
+        }
+        Transaction run[TXPACK_BLOCK_RECORDS];
+        while (index < end && !found) {
+            uint32_t block = index / TXPACK_BLOCK_RECORDS, next = (block + 1) * TXPACK_BLOCK_RECORDS;
+            int got = 0;
+            if (!pack) {
+                ssize_t len = db_pread(atomic_load(&seg->fd), run, (size_t)(next - index) * sizeof(Transaction),
+                                       (off_t)index * (off_t)sizeof(Transaction));
+                got = len > 0 ? (int)(len / (ssize_t)sizeof(Transaction)) : 0;
+            } else if (offsets[block + 1] - offsets[block] != (next < txlog_segments.records ? next : txlog_segments.records) - block * TXPACK_BLOCK_RECORDS) {
+                got = txpack_copy(pack, index, run, TXPACK_BLOCK_RECORDS); // one byte per record is all holes
+            }
+            for (int i = 0; i < got && index + (uint32_t)i < end && !found; i++) {
+                if (run[i].transaction_id == first_id + (int32_t)index + i) { *tx = run[i]; found = first_id + (int32_t)index + i; }
+            }
+            index = next;
+        }
+    }
+    atomic_fetch_sub(&seg->readers, 1);
+    return found;
+}
+
+// The highest ID in the log, for startup.
+static int32_t txseg_last_id(void) {
+    uint32_t tail = atomic_load(&txlog_segments.tail);
+    off_t size = db_size(atomic_load(&txlog_segments.segs[tail].fd));
+    return (int32_t)((uint64_t)tail * txlog_segments.records + (uint64_t)(size / (off_t)sizeof(Transaction)));
+}
+
+static void txseg_sync_tail(void) {
+    if (fdatasync(atomic_load(&txlog_segments.segs[atomic_load(&txlog_segments.tail)].fd)) == -1) {
+        perror("fdatasync transaction segment");
+    }
+}
+
+// Packs sealed segment n into TXARCHIVE_DIR and removes its raw file, adding
+// the size of the pack to *packed. Returns 0 if packing failed, leaving the
+// segment where it is. Runs on the archiver thread, without txlog_mutex.
+static int txseg_archive(uint32_t n, size_t* packed) {
+    TxSegment* seg = &txlog_segments.segs[n];
+    if (!txseg_open_sealed(n)) return 1; // removed by hand
+    const Transaction* map = atomic_load(&seg->map);
+    if (!map) return 1;                  // packed before a crash
+    if (mkdir(TXARCHIVE_DIR, 0755) == -1 && errno != EEXIST) { perror(TXARCHIVE_DIR); return 0; }
+
+    char path[128], tmp_path[160];
+    txpack_path(path, sizeof(path), n);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    size_t size = 0;
+    uint8_t* image = txpack_encode(n, (int32_t)(n * txlog_segments.records + 1), map, txlog_segments.records, &size);
+    int fd = image ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444) : -1;
+    int ok = fd != -1 && write(fd, image, size) == (ssize_t)size && fdatasync(fd) == 0 && rename(tmp_path, path) == 0;
+    if (!ok) { perror("pack transaction segment"); unlink(tmp_path); }
+    if (fd != -1) close(fd);
+    free(image);
+    pthread_mutex_lock(&txlog_segments.open_lock);
+    ok = ok && txseg_open_pack(n);
+    pthread_mutex_unlock(&txlog_segments.open_lock);
+    if (!ok) return 0;
+
+    atomic_store(&seg->map, NULL);
+    while (atomic_load(&seg->readers) > 0) sched_yield();
+    munmap((void*)map, txlog_segments.bytes);
+    close(atomic_exchange(&seg->fd, -1));
+    char raw[128];
+    txseg_path(raw, sizeof(raw), n, 0);
+    if (unlink(raw) == -1) perror("remove transaction segment");
+    *packed += size;
+    return 1;
+}
+
+static pthread_cond_t txseg_archive_work = PTHREAD_COND_INITIALIZER; // with txlog_mutex
+
+// Archives sealed segments beyond the newest cfg_live_segments, oldest first.
+// Only the manifest update takes txlog_mutex, so the logger keeps appending
+// while a segment is packed. first_live moves past a segment once its pack is
+// in place; one that failed to pack is tried again after the next rotation.
+static void* txseg_archiver(void* arg) {
+    (void)arg;
+    TxManifest* m = &txlog_segments.manifest;
+    int failed = 0;
+    uint32_t failed_tail = 0;
+    pthread_mutex_lock(&txlog_mutex);
+    while (1) {
+        while (m->tail - m->first_live <= (uint32_t)cfg_live_segments || (failed && m->tail == failed_tail)) {
+            pthread_cond_wait(&txseg_archive_work, &txlog_mutex);
+        }
+        uint32_t n = m->first_live;
+        pthread_mutex_unlock(&txlog_mutex);
+        size_t size = 0;
+        int ok = txseg_archive(n, &size);
+        pthread_mutex_lock(&txlog_mutex);
+        failed = !ok;
+        failed_tail = m->tail;
+        if (!ok) continue;
+        m->first_live = n + 1;
+        if (size > 0) {
+            txlog_segments.packed_records += txlog_segments.records;
+            txlog_segments.packed_bytes += size;
+        }
+        txseg_write_manifest();
+    }
+    return NULL;
+}
+
+// Seals the full tail and starts the next segment. Called under txlog_mutex.
+static void txseg_rotate(void) {
+    uint32_t n = atomic_load(&txlog_segments.tail);
+    int fd = atomic_load(&txlog_segments.segs[n].fd);
+    if (fdatasync(fd) == -1) perror("fdatasync transaction segment");
+    if (fchmod(fd, 0444) == -1) perror("seal transaction segment");
+    txseg_open_sealed(n);
+
+    int next = txseg_open_file(n + 1, O_RDWR | O_CREAT);
+    if (next == -1) { perror("create transaction segment"); exit(EXIT_FAILURE); }
+    atomic_store(&txlog_segments.segs[n + 1].fd, next);
+    atomic_store(&txlog_segments.tail, n + 1);
+
+    txlog_segments.manifest.tail = n + 1;
+    txseg_write_manifest();
+    pthread_cond_signal(&txseg_archive_work);
+}
+
+// Writes records with consecutive IDs. Called under txlog_mutex.
+static void txseg_write(const Transaction* txs, int n) {
+    for (int i = 0; i < n; ) {
+        int32_t id = txs[i].transaction_id;
+        uint32_t seg = txseg_of(id), index = txseg_index(id), tail = atomic_load(&txlog_segments.tail);
+        int run = n - i;
+        if ((uint32_t)run > txlog_segments.records - index) run = (int)(txlog_segments.records - index);
+        if (seg == tail) {
+            size_t len = (size_t)run * sizeof(Transaction);
+            if (db_pwrite(atomic_load(&txlog_segments.segs[seg].fd), &txs[i], len,
+                          (off_t)index * (off_t)sizeof(Transaction)) != (ssize_t)len) {
+                perror("write transaction segment");
+            } else if (index + (uint32_t)run == txlog_segments.records) {
+                txseg_rotate();
+            }
+        } else if (seg > tail) {
+            fprintf(stderr, "Transaction %d is past the tail segment %u; not logged.\n", id, tail);
+        }
+        // Before the tail: sealed, so the records are already durable (WAL replay)
+        i += run;
+    }
+}
+
+// Splits an older single-file TRANSACTION_FILE into segments, then removes it.
+static void txseg_migrate(int legacy_fd) {
+    off_t size = db_size(legacy_fd);
+    uint32_t records = txlog_segments.records;
+    int32_t count = (int32_t)(size / (off_t)sizeof(Transaction));
+    Transaction* buf = (Transaction*)malloc(TXSEGMENT_READ_RUN * sizeof(Transaction));
+    if (!buf) { perror("malloc"); exit(EXIT_FAILURE); }
+    uint32_t last = count > 0 ? (uint32_t)(count - 1) / records : 0;
+    for (uint32_t n = 0; n <= last; n++) {
+        int fd = txseg_open_file(n, O_RDWR | O_CREAT | O_TRUNC);
+        if (fd == -1) { perror("create transaction segment"); exit(EXIT_FAILURE); }
+        int32_t end = (int32_t)((uint64_t)(n + 1) * records < (uint64_t)count ? (n + 1) * records : (uint32_t)count);
+        for (int32_t id = (int32_t)(n * records) + 1; id <= end; ) {
+            size_t want = (size_t)(end - id + 1 < TXSEGMENT_READ_RUN ? end - id + 1 : TXSEGMENT_READ_RUN);
+            ssize_t got = pread(legacy_fd, buf, want * sizeof(Transaction), (off_t)(id - 1) * (off_t)sizeof(Transaction));
+            if (got != (ssize_t)(want * sizeof(Transaction)) ||
+                pwrite(fd, buf, (size_t)got, (off_t)txseg_index(id) * (off_t)sizeof(Transaction)) != got) {
+                perror("migrate TRANSACTION_FILE"); exit(EXIT_FAILURE);
+            }
+            id += (int32_t)want;
+        }
+        if (fdatasync(fd) == -1) { perror("fdatasync transaction segment"); exit(EXIT_FAILURE); }
+        if (n < last || (uint32_t)end == (n + 1) * records) fchmod(fd, 0444);
+        close(fd);
+    }
+    free(buf);
+    txlog_segments.manifest.tail = last;
+    txseg_write_manifest();
+    if (unlink(TRANSACTION_FILE) == -1) perror("remove " TRANSACTION_FILE);
+    printf("Transaction log: split %d record(s) from %s into %u segment(s).\n", count, TRANSACTION_FILE, last + 1);
+}
+
+// Loads the manifest, creating it for a new log or an older single file,
+// and opens the tail for appending.
+static void open_txlog_segments(void) {
+    TxManifest* m = &txlog_segments.manifest;
+    int fd = open(TXMANIFEST_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        if (read(fd, m, sizeof(*m)) != (ssize_t)sizeof(*m) || m->magic != TXMANIFEST_MAGIC ||
+            m->records_per_segment == 0 || m->first_live > m->tail + 1) {
+            fprintf(stderr, "%s: not a transaction log manifest\n", TXMANIFEST_FILE);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    } else {
+        *m = (TxManifest){ TXMANIFEST_MAGIC, TXSEGMENT_RECORDS, 0, 0 };
+    }
+    txlog_segments.records = m->records_per_segment;
+    txlog_segments.bytes = (size_t)m->records_per_segment * sizeof(Transaction);
+
+    size_t max_segments = (size_t)TXSEGMENT_MAX_ID / m->records_per_segment + 2;
+    void* segs = mmap(NULL, max_segments * sizeof(TxSegment), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (segs == MAP_FAILED) { perror("mmap segment table"); exit(EXIT_FAILURE); }
+    txlog_segments.segs = (TxSegment*)segs;
+    for (size_t n = 0; n < max_segments; n++) atomic_init(&txlog_segments.segs[n].fd, -1);
+
+    if (fd == -1) {
+        int legacy = open(TRANSACTION_FILE, O_RDONLY | O_CLOEXEC);
+        if (legacy != -1) { txseg_migrate(legacy); close(legacy); }
+        else txseg_write_manifest();
+    }
+
+    // A crash during a rotation can leave the old tail sealed (full) or the
+    // next segment created before the manifest says so
+    uint32_t tail = m->tail;
+    int tail_fd;
+    while (1) {
+        tail_fd = txseg_open_file(tail, O_RDWR | O_CREAT);
+        if (tail_fd == -1 && errno == EACCES) tail_fd = txseg_open_file(tail, O_RDONLY);
+        if (tail_fd == -1) { perror("open transaction segment"); exit(EXIT_FAILURE); }
+        if (db_size(tail_fd) < (off_t)txlog_segments.bytes) break;
+        fdatasync(tail_fd);
+        atomic_store(&txlog_segments.segs[tail].fd, tail_fd);
+        tail++;
+    }
+    atomic_store(&txlog_segments.segs[tail].fd, tail_fd);
+    atomic_store(&txlog_segments.tail, tail);
+    if (m->tail != tail) {
+        m->tail = tail;
+        txseg_write_manifest();
+    }
+}
+
+// --- Transaction Index ---
+// TXINDEX_FILE chains each account's transactions newest-first, so a history
+// fetch reads only that account's records. entry[t].prev is the account's
+// transaction before t (0 ends the chain), and entry[t].jump one further back
+// along the same chain (see txindex_insert()), so a time-range listing finds
+// its newest ID in O(log n) steps instead of walking every newer entry. The
+// chain heads live in memory, one per ACCOUNT_FILE slot.
+//
+// entry[] is mapped MAP_SHARED with room to grow and is written once per
+// record. Checkpoints msync it, then write the heads and the last indexed ID
+// to TXHEADS_FILE, through a temporary file that replaces it once synced. At
+// startup the heads are loaded and the records logged after them are
+// re-indexed from the log segments. Unsynced entry[] pages therefore cost
+// only a short rescan, and a missing or corrupt TXHEADS_FILE a full one.
+#define TXINDEX_MAGIC 0x54584933u                           // "TXI3"
+#define TXINDEX_MAP_BYTES ((size_t)12 << 31)                // 2^31 IDs of 12 bytes
+#define TXINDEX_GROW_BYTES (1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t checksum;       // FNV-1a of the header and the heads with this field zeroed
+    int32_t indexed_through;
+    int32_t count;           // TxIndexHead entries that follow
+} TxIndexCheckpoint;
+
+typedef struct {
+    int32_t account_id;
+    int32_t head;
+} TxIndexHead;
+
+typedef struct {
+    int32_t prev;            // the account's transaction before this one
+    int32_t jump;            // an older one on the same chain, or 0
+    int32_t depth;           // entries from the oldest, which has depth 1
+} TxIndexEntry;
+
+static struct {
+    int fd;
+    int ready;               // records logged before load_txindex() are picked up by its rescan
+    int32_t* heads;          // newest transaction ID per account slot
+    TxIndexEntry* entry;     // mapping of TXINDEX_FILE
+    size_t entry_bytes;      // bytes of entry[] backed by the file
+    int32_t indexed_through; // highest ID indexed
+} txindex = { .fd = -1 };
+
+static uint32_t txindex_checksum(const TxIndexCheckpoint* hdr, const TxIndexHead* heads) {
+    TxIndexCheckpoint copy = *hdr;
+    copy.checksum = 0;
+    uint32_t h = 2166136261u;
+    const uint8_t* p = (const uint8_t*)&copy;
+    for (size_t i = 0; i < sizeof(copy); i++) h = (h ^ p[i]) * 16777619u;
+    p = (const uint8_t*)heads;
+    for (size_t i = 0; i < (size_t)hdr->count * sizeof(TxIndexHead); i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// Links transaction t into its account's chain. IDs normally arrive in order
+// per account, so the walk stops at the head. Called under txlog_mutex.
+//
+// The jump pointers are skew-binary: an entry jumps as far as its parent's
+// jump and that entry's jump together when those two spans are equal, and
+// otherwise just to its parent. Any ancestor is then reached in O(log depth)
+// steps. An ID linked behind the head (out of order) only leaves newer
+// entries' jumps less even, never wrong: a jump always lands on an older
+// entry of the chain, and IDs fall along it.
+static void txindex_insert(int32_t t, int acc_id) {
+    int32_t slot = keyed_slot(&account_store, acc_id);
+    if (slot == 0 || t <= 0) return;
+    size_t need = ((size_t)t + 1) * sizeof(TxIndexEntry);
+    if (need > txindex.entry_bytes) {
+        size_t grown = (need + TXINDEX_GROW_BYTES - 1) / TXINDEX_GROW_BYTES * TXINDEX_GROW_BYTES;
+        if (grown > TXINDEX_MAP_BYTES || ftruncate(txindex.fd, (off_t)grown) == -1) {
+            perror("grow TXINDEX_FILE"); return;
+        }
+        txindex.entry_bytes = grown;
+    }
+
+    int32_t* link = &txindex.heads[slot];
+    while (*link > t) link = &txindex.entry[*link].prev;
+    if (*link != t) {
+        TxIndexEntry* e = txindex.entry, *parent = &e[*link]; // entry 0 is all zero and ends the chain
+        int32_t j = parent->jump;
+        e[t].prev = *link;
+        e[t].depth = parent->depth + 1;
+        e[t].jump = parent->depth - e[j].depth == e[j].depth - e[e[j].jump].depth ? e[j].jump : *link;
+        __atomic_store_n(link, t, __ATOMIC_RELEASE); // readers never see an unlinked ID
+    }
+    if (t > txindex.indexed_through) __atomic_store_n(&txindex.indexed_through, t, __ATOMIC_RELEASE);
+}
+
+// Fills out with up to max of the account's transactions with IDs from first
+// to last, newest first, starting at transaction *cursor (0 for the newest).
+// *cursor becomes the start of the next page, or 0 after the oldest. Returns
+// -1 if *cursor is not one of the account's transactions in range. Records
+// are immutable once logged, so no file lock is needed.
+static int txindex_page(int acc_id, uint64_t* cursor, Transaction* out, int max, int32_t first, int32_t last) {
+    int32_t slot = keyed_slot(&account_store, acc_id);
+    if (slot == 0) { *cursor = 0; return 0; }
+    int32_t t = __atomic_load_n(&txindex.heads[slot], __ATOMIC_ACQUIRE);
+    if (*cursor != 0) {
+        // Only indexed IDs have an entry to follow
+        if (*cursor > (uint64_t)__atomic_load_n(&txindex.indexed_through, __ATOMIC_ACQUIRE)) return -1;
+        if (*cursor > (uint64_t)last) return -1;
+        t = (int32_t)*cursor;
+    }
+    // Newer IDs are passed over through the index alone, without reading
+    // them; a jump is taken whenever it still lands after last
+    while (t > last) {
+        int32_t jump = __atomic_load_n(&txindex.entry[t].jump, __ATOMIC_ACQUIRE);
+        t = jump > last ? jump : __atomic_load_n(&txindex.entry[t].prev, __ATOMIC_ACQUIRE);
+    }
+    int count = 0;
+    while (count < max && t > 0 && t >= first) {
+        Transaction tx;
+        if (txseg_read(t, &tx) && tx.transaction_id == t && tx.account_id == acc_id) {
+            out[count++] = tx;
+        } else if (t == (int32_t)*cursor) {
+            return -1;
+        }
+        t = __atomic_load_n(&txindex.entry[t].prev, __ATOMIC_ACQUIRE);
+    }
+    *cursor = (uint64_t)(t > 0 && t >= first ? t : 0);
+    return count;
+}
+
+// Saves the heads once everything up to indexed_through is on disk.
+static void txindex_checkpoint(void) {
+    if (!txindex.ready) return;
+    const char* tmp_path = TXHEADS_FILE ".tmp";
+    int32_t slots = atomic_load(&account_store.slots);
+    TxIndexCheckpoint hdr = { TXINDEX_MAGIC, 0, 0, 0 };
+    TxIndexHead* heads = (TxIndexHead*)malloc((size_t)slots * sizeof(TxIndexHead));
+    if (!heads) { perror("malloc"); return; }
+
+    pthread_mutex_lock(&txlog_mutex);
+    if (msync(txindex.entry, txindex.entry_bytes, MS_SYNC) == -1) perror("msync TXINDEX_FILE");
+    hdr.indexed_through = txindex.indexed_through;
+    for (int32_t slot = 1; slot < slots; slot++) {
+        if (txindex.heads[slot] == 0) continue;
+        heads[hdr.count].account_id = account_table[slot].account_id;
+        heads[hdr.count++].head = txindex.heads[slot];
+    }
+    pthread_mutex_unlock(&txlog_mutex);
+
+    hdr.checksum = txindex_checksum(&hdr, heads);
+    size_t len = (size_t)hdr.count * sizeof(TxIndexHead);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 ||
+        pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        pwrite(fd, heads, len, (off_t)sizeof(hdr)) != (ssize_t)len ||
+        fdatasync(fd) == -1 || rename(tmp_path, TXHEADS_FILE) == -1) {
+        perror("write TXHEADS_FILE");
+    }
+    if (fd != -1) close(fd);
+    free(heads);
+}
+
+// Loads the heads saved by the last checkpoint. Returns 0 if there are none.
+static int load_txindex_heads(void) {
+    int fd = open(TXHEADS_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    TxIndexCheckpoint hdr;
+    TxIndexHead* heads = NULL;
+    int ok = pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && hdr.magic == TXINDEX_MAGIC &&
+             hdr.count >= 0 && hdr.count < KEYED_MAX_RECORDS;
+    if (ok) {
+        size_t len = (size_t)hdr.count * sizeof(TxIndexHead);
+        heads = (TxIndexHead*)malloc(len + 1);
+        ok = heads && pread(fd, heads, len, (off_t)sizeof(hdr)) == (ssize_t)len &&
+             txindex_checksum(&hdr, heads) == hdr.checksum;
+    }
+    close(fd);
+    if (ok) {
+        txindex.indexed_through = hdr.indexed_through;
+        for (int32_t i = 0; i < hdr.count; i++) {
+            int32_t slot = keyed_slot(&account_store, heads[i].account_id);
+            if (slot) txindex.heads[slot] = heads[i].head;
+        }
+    }
+    free(heads);
+    return ok;
+}
+
+// Loads the newest checkpoint and indexes every record logged after it.
+static void load_txindex(void) {
+    txindex.fd = open(TXINDEX_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (txindex.fd == -1) { perror(TXINDEX_FILE); exit(EXIT_FAILURE); }
+    txindex.heads = (int32_t*)reserve_per_slot(sizeof(int32_t));
+
+    // Without heads entry[] cannot be trusted (it may also be in an older
+    // layout), so start over and index the whole log
+    if (!load_txindex_heads() && ftruncate(txindex.fd, 0) == -1) {
+        perror("truncate TXINDEX_FILE"); exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (fstat(txindex.fd, &st) == -1) { perror("fstat TXINDEX_FILE"); exit(EXIT_FAILURE); }
+    txindex.entry_bytes = (size_t)st.st_size;
+    // Reserve the whole ID range up front; only the part backed by the file is touched
+    void* map = mmap(NULL, TXINDEX_MAP_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE,
+                     txindex.fd, 0);
+    if (map == MAP_FAILED) { perror("mmap TXINDEX_FILE"); exit(EXIT_FAILURE); }
+    txindex.entry = (TxIndexEntry*)map;
+
+    // Entries past the checkpoint may be stale, so rebuild them
+    int32_t from = txindex.indexed_through;
+    Transaction* run = (Transaction*)malloc(TXSEGMENT_READ_RUN * sizeof(Transaction));
+    if (!run) { perror("malloc"); exit(EXIT_FAILURE); }
+    int rescanned = 0;
+    pthread_mutex_lock(&txlog_mutex);
+    int32_t last = txseg_last_id();
+    for (int32_t id = from + 1; id > 0 && id <= last; ) {
+        int n = txseg_read_run(id, run, TXSEGMENT_READ_RUN);
+        if (n == 0) { // an archived segment that is gone: skip it
+            id = (int32_t)((txseg_of(id) + 1) * txlog_segments.records) + 1;
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (run[i].transaction_id != id + i) continue; // never written
+            txindex_insert(run[i].transaction_id, run[i].account_id);
+            rescanned++;
+        }
+        id += n;
+    }
+    txindex.ready = 1;
+    pthread_mutex_unlock(&txlog_mutex);
+    free(run);
+    if (rescanned > 0) printf("Transaction index: indexed %d record(s) logged since its last checkpoint.\n", rescanned);
+}
+
+// --- Transaction Logger (updated: serialized by txlog_mutex) ---
+// Writes records whose IDs were reserved by wal_append(). The IDs in one call
+// are consecutive, so this is one positional write per segment. Called by the logger
+// thread and by WAL replay.
+//
+// No file lock is taken. Records are never rewritten, and readers only follow
+// IDs that txindex_insert() published after the write, so a history scan
+// reads a snapshot as of the account's head when it started and never holds
+// up the logger.
+static void log_transactions(const Transaction* txs, int n) {
+    if (n == 0) return;
+    pthread_mutex_lock(&txlog_mutex); // NEW
+    txseg_write(txs, n);
+    if (txindex.ready) {
+        for (int i = 0; i < n; i++) txindex_insert(txs[i].transaction_id, txs[i].account_id);
+    }
+
+    pthread_mutex_unlock(&txlog_mutex); // NEW
+}
+
+static void set_tx(Transaction* tx, int acc_id, time_t now, const char* type, double amount, double new_balance) {
+    memset(tx, 0, sizeof(Transaction));
+    tx->account_id = acc_id; tx->timestamp = now;
+    strncpy(tx->type, type, 19);
+    tx->amount = amount; tx->new_balance = new_balance;
+}
+
+// --- Asynchronous Logger ---
+// Requests hand their records to a logger thread instead of writing them.
+// The thread writes runs of consecutive IDs with one log_transactions() call.
+//
+// The ring is lock-free for producers. txlog_claim() takes IDs from an atomic
+// counter, and ID t always lives in slot t % TXLOG_RING_SLOTS. Each slot's seq
+// tells its state: t means the slot is free for t, and t + 1 means t is
+// published. Freeing a slot sets seq to t + TXLOG_RING_SLOTS. The logger
+// consumes strictly in ID order, so everything below logged_through is in
+// the log segments. A producer waits only if the ring has wrapped onto a
+// slot the logger has not written yet. The mutex below is only for sleeping
+// and waking.
+//
+// Durability normally comes from the WAL. txlog_wait() lets a caller that
+// needs the file itself to be current wait for it, and optionally for an
+// fdatasync.
+#define TXLOG_RING_SLOTS 65536   // power of two
+#define TXLOG_BATCH 1024         // records per write
+
+typedef struct {
+    _Atomic uint64_t seq;
+    Transaction tx;
+} TxLogSlot;
+
+static struct {
+    TxLogSlot* ring;
+    _Atomic int32_t claimed;          // last ID handed out
+    _Atomic int32_t logged_through;   // every ID up to this is written and indexed
+    _Atomic int sleeping;             // the logger is waiting for work
+    int running;
+    int32_t sync_requested;           // guarded by lock
+    int32_t synced_through;
+    unsigned long batches, records, syncs;
+    pthread_mutex_t lock;
+    pthread_cond_t work;              // wakes the logger
+    pthread_cond_t progress;          // logged_through or synced_through advanced
+} txlog = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+            .progress = PTHREAD_COND_INITIALIZER };
+
+// Newest published ID per account slot, so a history read can wait for its own writes
+static int32_t* txlog_account_tail;
+
+// Hands out n consecutive IDs. Callers must publish every ID they claim.
+static int32_t txlog_claim(int n) {
+    return atomic_fetch_add(&txlog.claimed, n) + 1;
+}
+
+static void txlog_publish(const Transaction* txs, int n) {
+    for (int i = 0; i < n; i++) {
+        int32_t t = txs[i].transaction_id;
+        TxLogSlot* slot = &txlog.ring[(uint32_t)t & (TXLOG_RING_SLOTS - 1)];
+        while (atomic_load_explicit(&slot->seq, memory_order_acquire) != (uint64_t)t) sched_yield(); // ring full
+        slot->tx = txs[i];
+        atomic_store_explicit(&slot->seq, (uint64_t)t + 1, memory_order_release);
+        int32_t acc_slot = keyed_slot(&account_store, txs[i].account_id);
+        if (acc_slot) __atomic_store_n(&txlog_account_tail[acc_slot], t, __ATOMIC_RELEASE);
+    }
+    // Pairs with the fence in txlog_main(): either it sees the record or we see it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&txlog.sleeping)) {
+        pthread_mutex_lock(&txlog.lock);
+        pthread_cond_signal(&txlog.work);
+        pthread_mutex_unlock(&txlog.lock);
+    }
+}
+
+// Waits until every record up to id is in the log and, if durable is
+// set, synced. Before the logger starts, records are written synchronously.
+static void txlog_wait(int32_t id, int durable) {
+    if (!txlog.running) {
+        if (durable) txseg_sync_tail();
+        return;
+    }
+    if (!durable && atomic_load(&txlog.logged_through) >= id) return;
+    pthread_mutex_lock(&txlog.lock);
+    if (durable && txlog.sync_requested < id) {
+        txlog.sync_requested = id;
+        pthread_cond_signal(&txlog.work);
+    }
+    while (durable ? txlog.synced_through < id : atomic_load(&txlog.logged_through) < id) {
+        pthread_cond_wait(&txlog.progress, &txlog.lock);
+    }
+    pthread_mutex_unlock(&txlog.lock);
+}
+
+static void* txlog_main(void* arg) {
+    (void)arg;
+    Transaction* batch = (Transaction*)malloc(TXLOG_BATCH * sizeof(Transaction));
+    if (!batch) { perror("malloc"); exit(EXIT_FAILURE); }
+    int32_t next = atomic_load(&txlog.logged_through) + 1;
+    while (1) {
+        int n = 0;
+        while (n < TXLOG_BATCH) {
+            TxLogSlot* slot = &txlog.ring[(uint32_t)(next + n) & (TXLOG_RING_SLOTS - 1)];
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != (uint64_t)(next + n) + 1) break;
+            batch[n++] = slot->tx;
+        }
+
+        if (n > 0) {
+            log_transactions(batch, n);
+            for (int i = 0; i < n; i++) {
+                TxLogSlot* slot = &txlog.ring[(uint32_t)(next + i) & (TXLOG_RING_SLOTS - 1)];
+                atomic_store_explicit(&slot->seq, (uint64_t)(next + i) + TXLOG_RING_SLOTS, memory_order_release);
+            }
+            next += n;
+            atomic_store(&txlog.logged_through, next - 1);
+        }
+
+        pthread_mutex_lock(&txlog.lock);
+        if (n > 0) { txlog.batches++; txlog.records += (unsigned long)n; }
+        if (txlog.synced_through < txlog.sync_requested && atomic_load(&txlog.logged_through) >= txlog.sync_requested) {
+            int32_t through = atomic_load(&txlog.logged_through);
+            pthread_mutex_unlock(&txlog.lock);
+            pthread_mutex_lock(&txlog_mutex); // the tail must not rotate under the sync
+            txseg_sync_tail();
+            pthread_mutex_unlock(&txlog_mutex);
+            pthread_mutex_lock(&txlog.lock);
+            txlog.synced_through = through;
+            txlog.syncs++;
+        }
+        pthread_cond_broadcast(&txlog.progress);
+        if (n == 0) {
+            atomic_store(&txlog.sleeping, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            TxLogSlot* slot = &txlog.ring[(uint32_t)next & (TXLOG_RING_SLOTS - 1)];
+            int sync_pending = txlog.synced_through < txlog.sync_requested &&
+                               atomic_load(&txlog.logged_through) >= txlog.sync_requested;
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != (uint64_t)next + 1 && !sync_pending) {
+                pthread_cond_wait(&txlog.work, &txlog.lock);
+            }
+            atomic_store(&txlog.sleeping, 0);
+        }
+        pthread_mutex_unlock(&txlog.lock);
+    }
+    return NULL;
+}
+
+// IDs continue from the end of the tail segment. Runs after WAL replay.
+static void start_txlog(void) {
+    int32_t last = txseg_last_id();
+
+    txlog.ring = (TxLogSlot*)malloc(TXLOG_RING_SLOTS * sizeof(TxLogSlot));
+    if (!txlog.ring) { perror("malloc"); exit(EXIT_FAILURE); }
+    for (int32_t i = 0; i < TXLOG_RING_SLOTS; i++) {
+        // The first ID after last that maps to slot i
+        uint64_t first = (uint64_t)last + 1 + (uint64_t)((uint32_t)(i - (last + 1)) & (TXLOG_RING_SLOTS - 1));
+        atomic_init(&txlog.ring[i].seq, first);
+    }
+    atomic_store(&txlog.claimed, last);
+    atomic_store(&txlog.logged_through, last);
+    txlog.sync_requested = txlog.synced_through = last;
+    txlog_account_tail = (int32_t*)reserve_per_slot(sizeof(int32_t));
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, txlog_main, NULL) != 0) { perror("pthread_create"); exit(EXIT_FAILURE); }
+    pthread_detach(tid);
+    txlog.running = 1;
+
+    // Catches up at once if -a is lower than last time
+    if (cfg_live_segments > 0) {
+        if (pthread_create(&tid, NULL, txseg_archiver, NULL) != 0) { perror("pthread_create"); exit(EXIT_FAILURE); }
+        pthread_detach(tid);
+    }
+}
+
+// Newest-first history that includes every record this account has published.
+// Paged like txindex_page(); only the first page needs to wait for the logger.
+static int account_history(int acc_id, uint64_t* cursor, Transaction* out, int max) {
+    int32_t slot = keyed_slot(&account_store, acc_id);
+    if (*cursor == 0 && slot) {
+        txlog_wait(__atomic_load_n(&txlog_account_tail[slot], __ATOMIC_ACQUIRE), 0);
+    }
+    return txindex_page(acc_id, cursor, out, max, 1, INT32_MAX);
+}
+
+// --- Time-Range Listings ---
+// Timestamps never decrease along the log (wal_append() clamps them), so the
+// transactions logged between two times are one run of IDs whose ends are
+// found by binary search over the records themselves: O(log n) reads, with
+// no index to keep.
+
+// The first ID from id to hi with a record, which goes in *tx, or 0 if there
+// is none. Each segment is searched by txseg_next_written(); a segment that
+// was taken out of TXARCHIVE_DIR is passed over whole.
+static int32_t txlog_next_written(int32_t id, int32_t hi, Transaction* tx) {
+    while (id > 0 && id <= hi) {
+        int32_t found = txseg_next_written(id, hi, tx);
+        if (found) return found;
+        id = (int32_t)((txseg_of(id) + 1) * txlog_segments.records) + 1;
+    }
+    return 0;
+}
+
+// The first ID from lo to hi logged at or after t (after t if strict), or
+// hi + 1. IDs without a record hold nothing to list, so the search decides
+// on the next record that does exist; the result may be such an ID, which
+// every caller skips.
+static int32_t txlog_search_time(time_t t, int strict, int32_t lo, int32_t hi) {
+    while (lo <= hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        Transaction tx;
+        int32_t found = txlog_next_written(mid, hi, &tx);
+        if (found == 0 || (strict ? tx.timestamp > t : tx.timestamp >= t)) {
+            hi = mid - 1;  // nothing from mid to found is older
+        } else {
+            lo = found + 1;
+        }
+    }
+    return lo;
+}
+
+// The account's transactions logged from `from` to `to`, newest first.
+// Paged like account_history().
+static int account_range(int acc_id, time_t from, time_t to, uint64_t* cursor, Transaction* out, int max) {
+    int32_t slot = keyed_slot(&account_store, acc_id);
+    if (*cursor == 0 && slot) {
+        txlog_wait(__atomic_load_n(&txlog_account_tail[slot], __ATOMIC_ACQUIRE), 0);
+    }
+    int32_t logged = atomic_load(&txlog.logged_through);
+    int32_t last = txlog_search_time(to, 1, 1, logged) - 1;
+    int32_t first = txlog_search_time(from, 0, 1, last);
+    return txindex_page(acc_id, cursor, out, max, first, last);
+}
+
+// Every transaction logged from `from` to `to`, oldest first. *cursor is the
+// next ID to look at (0 to start) and becomes 0 after the last one. Returns
+// -1 if *cursor is past the log.
+static int txlog_range(time_t from, time_t to, uint64_t* cursor, Transaction* out, int max) {
+    int32_t logged = atomic_load(&txlog.logged_through);
+    if (*cursor > (uint64_t)logged + 1) return -1;
+    int32_t id = *cursor ? (int32_t)*cursor : txlog_search_time(from, 0, 1, logged);
+    int count = 0;
+    while (count < max && id <= logged) {
+        int want = max - count;
+        if (want > logged - id + 1) want = logged - id + 1;
+        int n = txseg_read_run(id, &out[count], want);
+        if (n == 0) { // a segment that is gone: skip it
+            id = (int32_t)((txseg_of(id) + 1) * txlog_segments.records) + 1;
+            continue;
+        }
+        int base = count;
+        for (int i = 0; i < n; i++) {
+            const Transaction* tx = &out[base + i];
+            if (tx->transaction_id != id + i) continue; // never written
+            if (tx->timestamp > to) { *cursor = 0; return count; }
+            out[count++] = *tx;
+        }
+        id += n;
+    }
+    *cursor = (uint64_t)(id <= logged ? id : 0);
+    return count;
+}
+
+// --- Transaction Analytics (MGR_TX_QUERY) ---
+// Queries run over a columnar projection of the log: for each segment, one
+// array per field, 29 bytes a record. The newest TXCOLUMNS_CACHED_SEGMENTS
+// segments keep theirs between queries, the tail's extended as it grows;
+// recent data is what most queries look at. Older segments are projected
+// into a buffer of the thread that scans them, once per query, so memory
+// stays bounded however much of the log is queried. Rows that cannot be read
+// match nothing and are not kept, so a later query reads them again.
+//
+// A query finds the run of IDs in its time range with txlog_search_time(),
+// then hands the segments of that run out to one thread per CPU. Each thread
+// tests every filter on every row without branching and adds into its own
+// totals or group table; the tables are merged at the end. Queries run one at
+// a time, each on every core.
+#define TXQUERY_MAX_THREADS 64
+#define TXQUERY_GROUP_BITS 11       // 2048 slots, over twice MAX_QUERY_GROUPS
+#define TXQUERY_GROUP_SLOTS (1 << TXQUERY_GROUP_BITS)
+#define TX_TYPE_NONE TX_TYPE_COUNT  // a record never written; matches nothing
+#define TXCOLUMNS_CACHED_SEGMENTS 8 // about 15 MB at TXSEGMENT_RECORDS
+
+struct TxColumns {
+    int32_t rows;       // records projected so far
+    int32_t* account;
+    int64_t* timestamp;
+    uint8_t* type;      // TxType or TX_TYPE_NONE
+    double* amount;
+    double* balance;
+};
+
+typedef struct {
+    TxQueryRow rows[TXQUERY_GROUP_SLOTS];
+    uint8_t used[TXQUERY_GROUP_SLOTS];
+    int groups;
+    int truncated;
+} TxGroupTable;
+
+typedef struct {
+    const TxQuery* q;
+    uint32_t types;                // q->types, never including TX_TYPE_NONE
+    int32_t first, last;           // IDs in the time range
+    uint32_t cached_from;          // segments from here on keep their columns
+    _Atomic uint32_t next_segment;
+    uint32_t last_segment;
+    _Atomic uint64_t scanned;
+    _Atomic int failed;
+} TxQueryJob;
+
+typedef struct {
+    TxQueryJob* job;
+    TxGroupTable* groups;
+    pthread_t tid;
+} TxQueryThread;
+
+static pthread_mutex_t txquery_lock = PTHREAD_MUTEX_INITIALIZER; // also guards TxSegment.columns
+static uint32_t txcolumns_oldest;   // no segment before this has columns
+
+static TxType tx_type_of(const char* type) {
+    for (int i = 0; i < TX_TYPE_COUNT - 1; i++) {
+        if (strcmp(type, tx_type_names[i]) == 0) return (TxType)(i + 1);
+    }
+    return TX_TYPE_OTHER;
+}
+
+static TxColumns* txcolumns_alloc(void) {
+    size_t records = txlog_segments.records;
+    TxColumns* col = (TxColumns*)calloc(1, sizeof(TxColumns));
+    if (!col) return NULL;
+    col->account = (int32_t*)malloc(records * sizeof(int32_t));
+    col->timestamp = (int64_t*)malloc(records * sizeof(int64_t));
+    col->type = (uint8_t*)malloc(records);
+    col->amount = (double*)malloc(records * sizeof(double));
+    col->balance = (double*)malloc(records * sizeof(double));
+    if (!col->account || !col->timestamp || !col->type || !col->amount || !col->balance) {
+        free(col->account); free(col->timestamp); free(col->type); free(col->amount); free(col->balance);
+        free(col);
+        return NULL;
+    }
+    return col;
+}
+static void txcolumns_free(TxColumns* col) {
+    if (!col) return;
+    free(col->account); free(col->timestamp); free(col->type); free(col->amount); free(col->balance);
+    free(col);
+}
+
+// Drops the columns of segments that are no longer among the newest
+// TXCOLUMNS_CACHED_SEGMENTS, and returns the first segment that is.
+// Called under txquery_lock, before a query starts its threads.
+static uint32_t txcolumns_evict(void) {
+    uint32_t tail = atomic_load(&txlog_segments.tail);
+    uint32_t cached_from = tail >= TXCOLUMNS_CACHED_SEGMENTS - 1 ? tail - (TXCOLUMNS_CACHED_SEGMENTS - 1) : 0;
+    for (; txcolumns_oldest < cached_from; txcolumns_oldest++) {
+        TxSegment* seg = &txlog_segments.segs[txcolumns_oldest];
+        txcolumns_free(seg->columns);
+        seg->columns = NULL;
+    }
+    return cached_from;
+}
+
+// Projects rows from col->rows up to target of segment n into col. Rows that
+// cannot be read now, in a segment that is gone or failed to open, are
+// marked TX_TYPE_NONE for this query only: col->rows stops before them.
+static void txcolumns_fill(TxColumns* col, uint32_t n, int32_t target, Transaction* buf) {
+    int32_t base = (int32_t)(n * txlog_segments.records) + 1;
+    while (col->rows < target) {
+        int want = target - col->rows < TXSEGMENT_READ_RUN ? target - col->rows : TXSEGMENT_READ_RUN;
+        int got = txseg_read_run(base + col->rows, buf, want);
+        if (got == 0) {
+            memset(&col->type[col->rows], TX_TYPE_NONE, (size_t)(target - col->rows));
+            return;
+        }
+        for (int i = 0; i < got; i++) {
+            const Transaction* tx = &buf[i];
+            int32_t r = col->rows + i;
+            col->account[r] = tx->account_id;
+            col->timestamp[r] = (int64_t)tx->timestamp;
+            col->type[r] = tx->transaction_id == base + r ? (uint8_t)tx_type_of(tx->type) : TX_TYPE_NONE;
+            col->amount[r] = tx->amount;
+            col->balance[r] = tx->new_balance;
+        }
+        col->rows += got;
+    }
+}
+
+// The columns of segment n covering rows begin to end: its cached ones, or
+// else those rows projected into *scratch, allocated on first use. Returns
+// NULL if out of memory. Only the thread that took segment n touches it.
+static TxColumns* txcolumns_get(const TxQueryJob* job, uint32_t n, int32_t begin, int32_t end,
+                                TxColumns** scratch, Transaction* buf) {
+    TxColumns* col;
+    if (n >= job->cached_from) {
+        TxSegment* seg = &txlog_segments.segs[n];
+        if (!seg->columns) seg->columns = txcolumns_alloc();
+        col = seg->columns;
+    } else {
+        if (!*scratch) *scratch = txcolumns_alloc();
+        col = *scratch;
+        if (col) col->rows = begin;
+    }
+    if (col) txcolumns_fill(col, n, end, buf);
+    return col;
+}
+
+// 1 if row i passes every filter. No branches, so the loops below stay tight.
+static inline int txquery_match(const TxQueryJob* job, const TxColumns* col, int32_t i) {
+    const TxQuery* q = job->q;
+    return (int)((job->types >> col->type[i]) & 1) &
+           (col->timestamp[i] >= (int64_t)q->from) & (col->timestamp[i] <= (int64_t)q->to) &
+           ((q->account_id == 0) | (col->account[i] == q->account_id)) &
+           (col->amount[i] >= q->min_amount) & (col->amount[i] <= q->max_amount);
+}
+
+static inline void txquery_add(TxQueryRow* row, double v) {
+    row->count++;
+    row->sum += v;
+    if (v < row->min) row->min = v;
+    if (v > row->max) row->max = v;
+}
+
+// The group for key, added if there is room. Returns NULL once the table
+// holds MAX_QUERY_GROUPS others.
+static TxQueryRow* txquery_group(TxGroupTable* t, int64_t key) {
+    uint32_t h = (uint32_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> (64 - TXQUERY_GROUP_BITS));
+    while (t->used[h]) {
+        if (t->rows[h].key == key) return &t->rows[h];
+        h = (h + 1) & (TXQUERY_GROUP_SLOTS - 1);
+    }
+    if (t->groups >= MAX_QUERY_GROUPS) { t->truncated = 1; return NULL; }
+    t->used[h] = 1;
+    t->groups++;
+    t->rows[h] = (TxQueryRow){ key, 0, 0.0, DBL_MAX, -DBL_MAX };
+    return &t->rows[h];
+}
+
+static void txquery_merge(TxGroupTable* into, const TxQueryRow* row) {
+    TxQueryRow* g = txquery_group(into, row->key);
+    if (!g) return;
+    g->count += row->count;
+    g->sum += row->sum;
+    if (row->min < g->min) g->min = row->min;
+    if (row->max > g->max) g->max = row->max;
+}
+
+// Ungrouped: plain running totals over rows [begin, end).
+static void txquery_sum(const TxQueryJob* job, const TxColumns* col, int32_t begin, int32_t end, TxQueryRow* total) {
+    const double* measure = job->q->measure == TX_MEASURE_BALANCE ? col->balance : col->amount;
+    uint64_t count = 0;
+    double sum = 0.0, min = total->min, max = total->max;
+    for (int32_t i = begin; i < end; i++) {
+        int keep = txquery_match(job, col, i);
+        double v = measure[i];
+        count += (uint64_t)keep;
+        sum += keep ? v : 0.0;
+        min = keep && v < min ? v : min;
+        max = keep && v > max ? v : max;
+    }
+    total->count += count; total->sum += sum; total->min = min; total->max = max;
+}
+
+static void txquery_group_rows(const TxQueryJob* job, const TxColumns* col, int32_t begin, int32_t end, TxGroupTable* t) {
+    const double* measure = job->q->measure == TX_MEASURE_BALANCE ? col->balance : col->amount;
+    for (int32_t i = begin; i < end; i++) {
+        if (!txquery_match(job, col, i)) continue;
+        int64_t key;
+        switch (job->q->group_by) {
+            case TX_GROUP_DAY: {
+                int64_t ts = col->timestamp[i];
+                key = ts >= 0 ? ts / 86400 : -((-ts + 86399) / 86400);
+                break;
+            }
+            case TX_GROUP_TYPE: key = col->type[i]; break;
+            default:            key = col->account[i]; break;
+        }
+        TxQueryRow* row = txquery_group(t, key);
+        if (row) txquery_add(row, measure[i]);
+    }
+}
+
+static void* txquery_thread(void* arg) {
+    TxQueryThread* th = (TxQueryThread*)arg;
+    TxQueryJob* job = th->job;
+    uint32_t records = txlog_segments.records;
+    Transaction* buf = (Transaction*)malloc(TXSEGMENT_READ_RUN * sizeof(Transaction));
+    if (!buf) { atomic_store(&job->failed, 1); return NULL; }
+    TxColumns* scratch = NULL;
+    TxQueryRow total = { 0, 0, 0.0, DBL_MAX, -DBL_MAX };
+    uint64_t scanned = 0;
+    uint32_t n;
+    while ((n = atomic_fetch_add(&job->next_segment, 1)) <= job->last_segment) {
+        int32_t seg_first = (int32_t)(n * records) + 1;
+        int32_t begin = (job->first > seg_first ? job->first : seg_first) - seg_first;
+        int32_t end = (job->last < seg_first + (int32_t)records - 1 ? job->last : seg_first + (int32_t)records - 1) - seg_first + 1;
+        TxColumns* col = txcolumns_get(job, n, begin, end, &scratch, buf);
+        if (!col) { atomic_store(&job->failed, 1); continue; }
+        scanned += (uint64_t)(end - begin);
+        if (job->q->group_by == TX_GROUP_NONE) txquery_sum(job, col, begin, end, &total);
+        else txquery_group_rows(job, col, begin, end, th->groups);
+    }
+    if (job->q->group_by == TX_GROUP_NONE && total.count > 0) txquery_merge(th->groups, &total);
+    atomic_fetch_add(&job->scanned, scanned);
+    txcolumns_free(scratch);
+    free(buf);
+    return NULL;
+}
+
+static int compare_query_rows(const void* a, const void* b) {
+    int64_t x = ((const TxQueryRow*)a)->key, y = ((const TxQueryRow*)b)->key;
+    return (x > y) - (x < y);
+}
+
+static void handle_tx_query(Request* req, Response* res) {
+    const TxQuery* q = &req->data.query;
+    uint32_t all_types = (1u << TX_TYPE_COUNT) - 1;
+    if (q->from > q->to || q->min_amount > q->max_amount || (q->types & ~all_types) ||
+        q->group_by < TX_GROUP_NONE || q->group_by > TX_GROUP_ACCOUNT ||
+        (q->measure != TX_MEASURE_AMOUNT && q->measure != TX_MEASURE_BALANCE)) {
+        res->success = 0; strcpy(res->message, "Invalid query."); return;
+    }
+
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (cpus > TXQUERY_MAX_THREADS) cpus = TXQUERY_MAX_THREADS;
+    TxQueryThread* threads = (TxQueryThread*)calloc((size_t)cpus, sizeof(TxQueryThread));
+    TxQueryRow* rows = (TxQueryRow*)malloc(MAX_QUERY_GROUPS * sizeof(TxQueryRow));
+    if (!threads || !rows) {
+        free(threads); free(rows);
+        res->success = 0; strcpy(res->message, "Server out of memory."); return;
+    }
+
+    uint64_t start = now_ns();
+    pthread_mutex_lock(&txquery_lock);
+    TxQueryJob job = { .q = q, .types = q->types ? q->types : all_types, .cached_from = txcolumns_evict() };
+    int32_t logged = atomic_load(&txlog.logged_through);
+    job.first = txlog_search_time(q->from, 0, 1, logged);
+    job.last = txlog_search_time(q->to, 1, job.first, logged) - 1;
+    int nthreads = 0;
+    if (job.first <= job.last) {
+        atomic_init(&job.next_segment, txseg_of(job.first));
+        job.last_segment = txseg_of(job.last);
+        nthreads = (int)(job.last_segment - txseg_of(job.first) + 1);
+        if (nthreads > cpus) nthreads = cpus;
+    }
+    // Thread 0 is this one; the rest are started for the query
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].job = &job;
+        threads[i].groups = (TxGroupTable*)calloc(1, sizeof(TxGroupTable));
+        if (!threads[i].groups) { nthreads = i; break; }
+        if (i > 0 && pthread_create(&threads[i].tid, NULL, txquery_thread, &threads[i]) != 0) {
+            free(threads[i].groups); nthreads = i; break;
+        }
+    }
+    if (nthreads > 0) txquery_thread(&threads[0]);
+    else if (job.first <= job.last) atomic_store(&job.failed, 1);
+    TxGroupTable* merged = nthreads > 0 ? threads[0].groups : (TxGroupTable*)calloc(1, sizeof(TxGroupTable));
+    for (int i = 1; i < nthreads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        for (int h = 0; merged && h < TXQUERY_GROUP_SLOTS; h++) {
+            if (threads[i].groups->used[h]) txquery_merge(merged, &threads[i].groups->rows[h]);
+        }
+        if (merged && threads[i].groups->truncated) merged->truncated = 1;
+        free(threads[i].groups);
+    }
+    pthread_mutex_unlock(&txquery_lock);
+
+    int count = 0, failed = atomic_load(&job.failed) || !merged;
+    if (merged) {
+        for (int h = 0; h < TXQUERY_GROUP_SLOTS; h++) {
+            if (merged->used[h]) rows[count++] = merged->rows[h];
+        }
+        if (q->group_by == TX_GROUP_NONE && count == 0) rows[count++] = (TxQueryRow){ 0, 0, 0.0, DBL_MAX, -DBL_MAX };
+        qsort(rows, (size_t)count, sizeof(TxQueryRow), compare_query_rows);
+        for (int i = 0; i < count; i++) {
+            if (rows[i].count == 0) rows[i].min = rows[i].max = 0.0;
+        }
+        res->data.query.truncated = merged->truncated;
+        free(merged);
+    }
+    free(threads);
+    if (failed) {
+        free(rows);
+        res->success = 0; strcpy(res->message, "Server out of memory."); return;
+    }
+    res->data.query.scanned = atomic_load(&job.scanned);
+    res->data.query.count = count;
+    res->data.query.rows = rows;
+    res->success = 1;
+    sprintf(res->message, "%d row(s) from %lu record(s) on %d thread(s) in %.1f ms.", count,
+            (unsigned long)res->data.query.scanned, nthreads, (double)(now_ns() - start) / 1e6);
+}
+
+// --- Write-Ahead Log ---
+// Every balance change is appended to WAL_FILE as one entry and made durable
+// before it touches the account table. An entry holds the new image of every
+// account the change touches plus the transaction records it produces.
+// Concurrent requests share an fdatasync: the committer thread waits up to
+// the commit window for more entries, then writes the whole group at once.
+//
+// Replay at startup re-applies every complete entry. Repeating it is harmless
+// because entries hold after-images and transaction records carry their final
+// IDs. Checkpoints sync the account mapping and the log's tail segment, then empty
+// the log.
+#define WAL_MAGIC 0x57414c31u                   // "WAL1"
+#define WAL_GROUP_BYTES (1024 * 1024)           // flush early once this much is waiting
+#define WAL_CHECKPOINT_BYTES (4 * 1024 * 1024)  // empty the log once it grows past this
+
+typedef struct {
+    uint32_t magic;
+    uint32_t checksum;    // FNV-1a of the whole entry with this field zeroed
+    uint64_t lsn;         // log position; each entry starts where the previous ended
+    uint32_t n_accounts;  // Account images follow the header,
+    uint32_t n_txs;       // then Transaction records
+} WalHeader;
+
+static int cfg_commit_window_us = 2000; // -c: how long the committer gathers a group
+
+static struct {
+    int fd;
+    uint8_t* buf;          // entries waiting for the committer
+    size_t len, cap;
+    uint8_t* flush_buf;    // the group the committer is writing
+    size_t flush_cap;
+    uint64_t next_lsn;     // lsn of the next entry
+    uint64_t durable_lsn;  // everything before this is on disk
+    off_t file_size;
+    int active;            // requests between wal_append and wal_end
+    int checkpointing;
+    time_t last_timestamp; // of the newest record; later ones never go below it
+    unsigned long entries, syncs;
+    pthread_mutex_t lock;
+    pthread_cond_t work;      // wakes the committer
+    pthread_cond_t changed;   // durable_lsn advanced, a request ended, or a checkpoint finished
+} wal = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t wal_checksum(const uint8_t* entry, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = (i >= offsetof(WalHeader, checksum) && i < offsetof(WalHeader, lsn)) ? 0 : entry[i];
+        h = (h ^ b) * 16777619u;
+    }
+    return h;
+}
+
+// Queues one entry, giving txs their final transaction IDs, and returns the
+// lsn that must be durable before the change may be applied. Waits while a
+// checkpoint is running. Every call must be paired with wal_end().
+static uint64_t wal_append(const Account* accs, int n_acc, Transaction* txs, int n_tx) {
+    size_t size = sizeof(WalHeader) + (size_t)n_acc * sizeof(Account) + (size_t)n_tx * sizeof(Transaction);
+    pthread_mutex_lock(&wal.lock);
+    while (wal.checkpointing) pthread_cond_wait(&wal.changed, &wal.lock);
+    wal.active++;
+
+    if (wal.len + size > wal.cap) {
+        size_t cap = wal.cap ? wal.cap : 65536;
+        while (cap < wal.len + size) cap *= 2;
+        uint8_t* grown = (uint8_t*)realloc(wal.buf, cap);
+        if (!grown) { perror("realloc WAL buffer"); exit(EXIT_FAILURE); }
+        wal.buf = grown; wal.cap = cap;
+    }
+    // IDs are claimed in log order, so a crash can never leave a gap in the log
+    int32_t first_id = n_tx > 0 ? txlog_claim(n_tx) : 0;
+    for (int i = 0; i < n_tx; i++) {
+        // Clocks can step back, and a request can take its time before
+        // reaching here; either would put the log out of time order. Such a
+        // record is stored with the newest time already logged instead of
+        // its own, because time-range listings binary-search the log and
+        // rely on times never decreasing (see txlog_search_time()).
+        txs[i].transaction_id = first_id + i;
+        if (txs[i].timestamp < wal.last_timestamp) txs[i].timestamp = wal.last_timestamp;
+        wal.last_timestamp = txs[i].timestamp;
+    }
+
+    uint8_t* entry = wal.buf + wal.len;
+    WalHeader hdr = { WAL_MAGIC, 0, wal.next_lsn, (uint32_t)n_acc, (uint32_t)n_tx };
+    memcpy(entry, &hdr, sizeof(hdr));
+    memcpy(entry + sizeof(hdr), accs, (size_t)n_acc * sizeof(Account));
+    memcpy(entry + sizeof(hdr) + (size_t)n_acc * sizeof(Account), txs, (size_t)n_tx * sizeof(Transaction));
+    hdr.checksum = wal_checksum(entry, size);
+    memcpy(entry + offsetof(WalHeader, checksum), &hdr.checksum, sizeof(hdr.checksum));
+
+    wal.len += size;
+    wal.next_lsn += size;
+    wal.entries++;
+    uint64_t lsn = wal.next_lsn;
+    pthread_cond_signal(&wal.work);
+    pthread_mutex_unlock(&wal.lock);
+    return lsn;
+}
+
+static void wal_wait(uint64_t lsn) {
+    pthread_mutex_lock(&wal.lock);
+    while (wal.durable_lsn < lsn) pthread_cond_wait(&wal.changed, &wal.lock);
+    pthread_mutex_unlock(&wal.lock);
+}
+
+// Syncs everything the log protects, then empties it. Called with wal.lock
+// held and no entries pending or in flight.
+static void wal_checkpoint(void) {
+    if (msync(account_table, (size_t)atomic_load(&account_store.slots) * sizeof(Account), MS_SYNC) == -1) perror("msync ACCOUNT_FILE");
+    txlog_wait(atomic_load(&txlog.claimed), 1);
+    txindex_checkpoint();
+    if (ftruncate(wal.fd, 0) == -1 || fdatasync(wal.fd) == -1) { perror("truncate WAL_FILE"); return; }
+    wal.file_size = 0;
+}
+
+static void wal_end(void) {
+    pthread_mutex_lock(&wal.lock);
+    wal.active--;
+    if (!wal.checkpointing && wal.file_size + (off_t)wal.len >= WAL_CHECKPOINT_BYTES) {
+        // This request runs the checkpoint once every other one has finished
+        wal.checkpointing = 1;
+        while (wal.active > 0 || wal.durable_lsn < wal.next_lsn) pthread_cond_wait(&wal.changed, &wal.lock);
+        wal_checkpoint();
+        wal.checkpointing = 0;
+    }
+    pthread_cond_broadcast(&wal.changed);
+    pthread_mutex_unlock(&wal.lock);
+}
+
+static void* wal_committer(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&wal.lock);
+    while (1) {
+        while (wal.len == 0) pthread_cond_wait(&wal.work, &wal.lock);
+        if (cfg_commit_window_us > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (long)cfg_commit_window_us * 1000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while (wal.len < WAL_GROUP_BYTES &&
+                   pthread_cond_timedwait(&wal.work, &wal.lock, &deadline) != ETIMEDOUT) {}
+        }
+
+        // Take the group and let new entries collect in the other buffer
+        uint8_t* group = wal.buf; size_t len = wal.len, cap = wal.cap;
+        wal.buf = wal.flush_buf; wal.cap = wal.flush_cap; wal.len = 0;
+        wal.flush_buf = group; wal.flush_cap = cap;
+        uint64_t end_lsn = wal.next_lsn;
+        off_t offset = wal.file_size;
+        wal.file_size += (off_t)len;
+        pthread_mutex_unlock(&wal.lock);
+
+        size_t off = 0;
+        while (off < len) {
+            ssize_t n = pwrite(wal.fd, group + off, len - off, offset + (off_t)off);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) { perror("write WAL_FILE"); exit(EXIT_FAILURE); }
+            off += (size_t)n;
+        }
+        if (fdatasync(wal.fd) == -1) { perror("fdatasync WAL_FILE"); exit(EXIT_FAILURE); }
+
+        pthread_mutex_lock(&wal.lock);
+        wal.durable_lsn = end_lsn;
+        wal.syncs++;
+        pthread_cond_broadcast(&wal.changed);
+    }
+    return NULL;
+}
+
+// Re-applies every complete entry left by the previous run. Stops at the
+// first torn, corrupt or out-of-sequence entry.
+static void replay_wal(void) {
+    off_t offset = 0;
+    uint64_t expected_lsn = 0;
+    int replayed = 0;
+    WalHeader hdr;
+    while (pread(wal.fd, &hdr, sizeof(hdr), offset) == (ssize_t)sizeof(hdr) && hdr.magic == WAL_MAGIC) {
+        if (replayed > 0 && hdr.lsn != expected_lsn) break;
+        if (hdr.n_accounts > MAX_BATCH_ITEMS + 1 || hdr.n_txs > 2 * MAX_BATCH_ITEMS) break;
+        size_t size = sizeof(WalHeader) + hdr.n_accounts * sizeof(Account) + hdr.n_txs * sizeof(Transaction);
+        uint8_t* entry = (uint8_t*)malloc(size);
+        if (!entry) break;
+        if (pread(wal.fd, entry, size, offset) != (ssize_t)size || wal_checksum(entry, size) != hdr.checksum) {
+            free(entry); break;
+        }
+
+        const Account* accs = (const Account*)(entry + sizeof(WalHeader));
+        const Transaction* txs = (const Transaction*)(accs + hdr.n_accounts);
+        for (uint32_t i = 0; i < hdr.n_accounts; i++) {
+            // An account created just before the crash may not have reached ACCOUNT_FILE
+            if (!account_write(accs[i].account_id, &accs[i])) keyed_append(&account_store, &accs[i]);
+        }
+        log_transactions(txs, (int)hdr.n_txs);
+        free(entry);
+
+        offset += (off_t)size;
+        expected_lsn = hdr.lsn + size;
+        replayed++;
+    }
+    if (replayed > 0) printf("WAL: replayed %d entr%s.\n", replayed, replayed == 1 ? "y" : "ies");
+    wal.next_lsn = wal.durable_lsn = expected_lsn;
+}
+
+// Opens and replays the log, then starts the committer. Runs before the workers.
+static void start_wal(void) {
+    wal.fd = open(WAL_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (wal.fd == -1) { perror(WAL_FILE); exit(EXIT_FAILURE); }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal.work, &attr);
+    pthread_cond_init(&wal.changed, NULL);
+    pthread_condattr_destroy(&attr);
+
+    replay_wal();
+    load_txindex(); // after replay, so its rescan sees no holes
+    wal_checkpoint();
+    start_txlog();
+    Transaction newest;
+    if (txseg_read(txseg_last_id(), &newest)) wal.last_timestamp = newest.timestamp;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, wal_committer, NULL) != 0) { perror("pthread_create"); exit(EXIT_FAILURE); }
+    pthread_detach(tid);
+}
+
+// Makes a balance change durable, then applies it. accs are the new images
+// of every account the change touches and txs the records it produces. The
+// caller holds the locks of those accounts.
+static void commit_update(const Account* accs, int n_acc, Transaction* txs, int n_tx) {
+    uint64_t lsn = wal_append(accs, n_acc, txs, n_tx);
+    wal_wait(lsn);
+    for (int i = 0; i < n_acc; i++) account_write(accs[i].account_id, &accs[i]);
+    txlog_publish(txs, n_tx);
+    wal_end();
+}
+
+
+// --- Server Configuration (command-line options) ---
+static int cfg_workers = 8;                // -w: worker threads
+static int cfg_queue_depth = 128;          // -q: requests waiting for a worker
+static int cfg_backlog = MAX_CLIENTS;      // -b: listen() backlog
+static int cfg_legacy_clients = 1;         // -F clears: accept fixed-size Request/Response clients
+
+// --- Reactor: per-connection state ---
+// Connections are non-blocking and owned by the single epoll thread. An idle
+// session costs only this struct; receive/send buffers are allocated while a
+// request is arriving in pieces or a reply cannot be written in one go.
+typedef enum { WIRE_UNKNOWN = 0, WIRE_LEGACY, WIRE_FRAMED } WireFormat;
+
+typedef struct Conn {
+    int fd;
+    int user_id;          // -1 means no user is logged in on this connection
+    UserRole user_role;
+    Session* session;     // the user's session while session_token is nonzero
+    uint32_t session_token;
+    WireFormat wire;      // decided by the first bytes the client sends
+    int inflight;         // requests queued or running on a worker
+    int exclusive;        // the request in flight must finish before any other starts
+    int stalled;          // a complete request is buffered but must wait its turn
+    int closing;          // peer went away with requests in flight; freed when they return
+    uint32_t watching;    // epoll events currently registered
+    uint8_t* rbuf;        // received bytes not yet dispatched (NULL when empty)
+    size_t rlen, rcap;
+    uint8_t* wbuf;        // replies the socket has not taken yet (NULL when empty)
+    size_t wlen, woff, wcap;
+    struct Job* parked;   // LIST_PAGE streams waiting for wbuf to drain; still inflight
+    struct Conn* next_closed;
+} Conn;
+
+#define MAX_EVENTS 256
+#define READ_CHUNK 4096
+#define MAX_PIPELINE 32           // requests in flight per connection
+#define MAX_PENDING_OUTPUT 65536  // stop taking requests while this much is unsent
+
+static int epoll_fd = -1;
+// Connections closed during the current epoll batch. They are freed after the
+// batch so a later event in the same batch never touches freed memory.
+static Conn* closed_conns;
+
+// --- Worker Pool ---
+// The reactor parses requests and hands them to a fixed set of workers through
+// a bounded queue. When the queue is full the request is answered at once with
+// "Server busy" instead of letting latency grow. Finished jobs come back to the
+// reactor through done_queue, which wakes epoll via an eventfd.
+typedef struct Job {
+    Conn* conn;
+    int user_id;          // session snapshot; LOGIN updates it on the worker
+    UserRole user_role;
+    Session* session;
+    uint32_t session_token;
+    int exclusive;
+    FrameHeader hdr;      // version 0 for legacy fixed-size requests
+    Request req;
+    Response res;
+    struct Job* next;
+} Job;
+
+static struct {
+    Job** ring;
+    int cap, head, count;
+    int high_water;
+    unsigned long accepted, rejected;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+} job_queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER };
+
+static struct {
+    Job* head;
+    Job* tail;
+    int event_fd;
+    pthread_mutex_t lock;
+} done_queue = { .event_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+typedef struct {
+    pthread_t tid;
+    _Atomic uint64_t busy_ns;     // time spent running jobs
+    _Atomic unsigned long jobs;
+    uint64_t busy_ns_reported;    // busy_ns at the previous stats dump
+} Worker;
+
+static Worker* workers;
+static uint64_t stats_reported_ns; // time of the previous stats dump
+
+// Per-opcode totals, reported by SERVER_STATS and the SIGUSR1 dump
+static struct {
+    _Atomic uint64_t requests;
+    _Atomic uint64_t db_syscalls;
+    _Atomic uint64_t busy_ns;
+} op_stats[MAX_OP_STATS];
+
+// Returns 0 if the queue is full.
+static int job_queue_push(Job* job) {
+    int ok = 0;
+    pthread_mutex_lock(&job_queue.lock);
+    if (job_queue.count < job_queue.cap) {
+        job_queue.ring[(job_queue.head + job_queue.count) % job_queue.cap] = job;
+        job_queue.count++;
+        if (job_queue.count > job_queue.high_water) job_queue.high_water = job_queue.count;
+        job_queue.accepted++;
+        ok = 1;
+        pthread_cond_signal(&job_queue.not_empty);
+    } else {
+        job_queue.rejected++;
+    }
+    pthread_mutex_unlock(&job_queue.lock);
+    return ok;
+}
+
+static Job* job_queue_pop(void) {
+    pthread_mutex_lock(&job_queue.lock);
+    while (job_queue.count == 0) pthread_cond_wait(&job_queue.not_empty, &job_queue.lock);
+    Job* job = job_queue.ring[job_queue.head];
+    job_queue.head = (job_queue.head + 1) % job_queue.cap;
+    job_queue.count--;
+    pthread_mutex_unlock(&job_queue.lock);
+    return job;
+}
+
+static void fill_op_stats(Response* res) {
+    int n = 0;
+    for (int op = 0; op < MAX_OP_STATS; op++) {
+        uint64_t requests = atomic_load(&op_stats[op].requests);
+        if (requests == 0) continue;
+        OpStats* st = &res->data.op_stats.ops[n++];
+        st->op = op;
+        st->requests = requests;
+        st->db_syscalls = atomic_load(&op_stats[op].db_syscalls);
+        st->busy_us = atomic_load(&op_stats[op].busy_ns) / 1000;
+    }
+    res->data.op_stats.count = n;
+    res->success = 1;
+    sprintf(res->message, "Stats for %d operation(s); %s locking.", n, cfg_shared_db ? "shared" : "single-owner");
+}
+
+// Runs one complete request on a worker.
+static void process_request(Job* job) {
+    Request* client_req = &job->req;
+    Response* server_res = &job->res;
+    int sock_fd = job->conn->fd;
+    memset(server_res, 0, sizeof(Response));
+    client_req->user_id = job->user_id;
+
+    if (client_req->op == LOGIN) {
+        Session* session = NULL;
+        uint32_t token = handle_login(sock_fd, client_req, server_res, &session);
+        if (server_res->success) {
+            // A second login on the connection gives up the first one's session
+            if (job->session_token) session_close(job->session, job->session_token);
+            job->user_id = server_res->data.user.id; // Connection now "owns" this user_id
+            job->user_role = server_res->data.user.role;
+            job->session = session; job->session_token = token;
+        }
+    } else if (client_req->op == SERVER_STATS) {
+        fill_op_stats(server_res);
+    } else if (job->user_id == -1) {
+        server_res->success = 0; strcpy(server_res->message, "Not logged in.");
+    }
+    else if (client_req->op == CHANGE_PASSWORD) {
+        handle_change_password(sock_fd, client_req, server_res);
+    }
+    else if (client_req->op == LIST_PAGE) {
+        handle_list_page(client_req, server_res, job->user_id, job->user_role);
+    }
+    else { // User is logged in, route to role
+        switch (job->user_role) {
+            case CUSTOMER:
+                handle_customer_operations(sock_fd, client_req, server_res);
+                break;
+            case EMPLOYEE:
+                handle_employee_operations(sock_fd, client_req, server_res);
+                break;
+            case MANAGER:
+                handle_manager_operations(sock_fd, client_req, server_res);
+                break;
+            case ADMIN:
+                handle_admin_operations(sock_fd, client_req, server_res);
+                break;
+            default:
+                server_res->success = 0; strcpy(server_res->message, "Unknown user role.");
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    Worker* w = (Worker*)arg;
+    while (1) {
+        Job* job = job_queue_pop();
+        uint64_t start = now_ns();
+        db_syscalls = 0;
+        process_request(job);
+        uint64_t elapsed = now_ns() - start;
+        atomic_fetch_add(&w->busy_ns, elapsed);
+        atomic_fetch_add(&w->jobs, 1);
+        if ((unsigned)job->req.op < MAX_OP_STATS) {
+            atomic_fetch_add(&op_stats[job->req.op].requests, 1);
+            atomic_fetch_add(&op_stats[job->req.op].db_syscalls, db_syscalls);
+            atomic_fetch_add(&op_stats[job->req.op].busy_ns, elapsed);
+        }
+
+        pthread_mutex_lock(&done_queue.lock);
+        job->next = NULL;
+        if (done_queue.tail) done_queue.tail->next = job; else done_queue.head = job;
+        done_queue.tail = job;
+        pthread_mutex_unlock(&done_queue.lock);
+
+        uint64_t one = 1;
+        if (write(done_queue.event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("write eventfd");
+        }
+    }
+    return NULL;
+}
+
+static void start_workers(void) {
+    job_queue.cap = cfg_queue_depth;
+    job_queue.ring = (Job**)calloc((size_t)cfg_queue_depth, sizeof(Job*));
+    workers = (Worker*)calloc((size_t)cfg_workers, sizeof(Worker));
+    if (!job_queue.ring || !workers) { perror("calloc"); exit(EXIT_FAILURE); }
+
+    done_queue.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_queue.event_fd == -1) { perror("eventfd"); exit(EXIT_FAILURE); }
+
+    for (int i = 0; i < cfg_workers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create"); exit(EXIT_FAILURE);
+        }
+    }
+    stats_reported_ns = now_ns();
+}
+
+// Prints queue depth, admission counters, per-worker utilization since the
+// previous dump, session counts and lock contention. Triggered by SIGUSR1.
+static void dump_stats(void) {
+    pthread_mutex_lock(&job_queue.lock);
+    int depth = job_queue.count, high_water = job_queue.high_water;
+    unsigned long accepted = job_queue.accepted, rejected = job_queue.rejected;
+    pthread_mutex_unlock(&job_queue.lock);
+
+    uint64_t now = now_ns();
+    double interval = (double)(now - stats_reported_ns);
+    stats_reported_ns = now;
+
+    printf("--- Server Stats ---\n");
+    printf("Queue: depth %d/%d, high water %d, accepted %lu, rejected %lu\n",
+           depth, job_queue.cap, high_water, accepted, rejected);
+    for (int i = 0; i < cfg_workers; i++) {
+        uint64_t busy = atomic_load(&workers[i].busy_ns);
+        double util = interval > 0 ? 100.0 * (double)(busy - workers[i].busy_ns_reported) / interval : 0.0;
+        workers[i].busy_ns_reported = busy;
+        printf("Worker %2d: %lu jobs, %5.1f%% busy\n", i, atomic_load(&workers[i].jobs), util);
+    }
+    for (int op = 0; op < MAX_OP_STATS; op++) {
+        uint64_t requests = atomic_load(&op_stats[op].requests);
+        if (requests == 0) continue;
+        printf("Op %2d: %lu requests, %.1f db syscalls/request, %.1f us/request\n", op, (unsigned long)requests,
+               (double)atomic_load(&op_stats[op].db_syscalls) / (double)requests,
+               (double)atomic_load(&op_stats[op].busy_ns) / 1000.0 / (double)requests);
+    }
+    pthread_mutex_lock(&txlog.lock);
+    printf("Logger: %lu records in %lu writes, %lu fdatasyncs, %d unwritten\n", txlog.records, txlog.batches,
+           txlog.syncs, (int)(atomic_load(&txlog.claimed) - atomic_load(&txlog.logged_through)));
+    pthread_mutex_unlock(&txlog.lock);
+    pthread_mutex_lock(&wal.lock);
+    unsigned long wal_entries = wal.entries, wal_syncs = wal.syncs;
+    pthread_mutex_unlock(&wal.lock);
+    pthread_mutex_lock(&txlog_mutex);
+    TxManifest segments = txlog_segments.manifest;
+    uint64_t packed_records = txlog_segments.packed_records, packed_bytes = txlog_segments.packed_bytes;
+    pthread_mutex_unlock(&txlog_mutex);
+    printf("Log segments: %u live (%u to %u), %u archived, %u records each\n", segments.tail - segments.first_live + 1,
+           segments.first_live, segments.tail, segments.first_live, segments.records_per_segment);
+    if (packed_records > 0) {
+        printf("Packed here: %lu records in %lu bytes (%.1f bytes/record, %.1fx smaller)\n",
+               (unsigned long)packed_records, (unsigned long)packed_bytes, (double)packed_bytes / (double)packed_records,
+               (double)(packed_records * sizeof(Transaction)) / (double)packed_bytes);
+    }
+    printf("WAL: %lu entries, %lu fdatasyncs (%.1f entries/sync), window %d us\n", wal_entries, wal_syncs,
+           wal_syncs ? (double)wal_entries / (double)wal_syncs : 0.0, cfg_commit_window_us);
+    printf("Sessions: %d active, %lu opened, %lu refused, %lu expired (idle timeout %d s)\n",
+           atomic_load(&session_stats.active), atomic_load(&session_stats.opened),
+           atomic_load(&session_stats.refused), atomic_load(&session_stats.expired), cfg_session_timeout);
+    dump_lock_stats();
+    fflush(stdout);
+}
+
+// Raise the soft descriptor limit so one process can hold 10k+ sessions.
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1) { perror("setrlimit"); }
+    }
+}
+
+static void close_connection(Conn* c) {
+    while (c->parked) {
+        Job* job = c->parked;
+        c->parked = job->next;
+        c->inflight--;
+        proto_release_request(&job->req);
+        free(job);
+    }
+    if (c->inflight > 0) {
+        // Workers still hold this connection; finish once their jobs come back.
+        if (!c->closing) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        c->closing = 1;
+        return;
+    }
+
+    // --- SESSION CLEANUP ---
+    if (c->session_token) { // Only if a user was successfully logged in
+        session_close(c->session, c->session_token); // Free the session
+        printf("Session cleared for user %d.\n", c->user_id);
+    }
+    // --- END SESSION CLEANUP ---
+
+    printf("Closing connection socket.\n");
+    if (!c->closing) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->rbuf); free(c->wbuf);
+    c->rbuf = c->wbuf = NULL;
+    c->closing = 1;
+    c->next_closed = closed_conns; closed_conns = c;
+}
+
+// Switch between waiting for requests, waiting for the socket to drain, both,
+// or (events == 0) only for workers.
+static void watch_connection(Conn* c, uint32_t events) {
+    if (c->watching == events) return;
+    struct epoll_event ev;
+    ev.events = (events & EPOLLIN) ? (events | EPOLLRDHUP) : events; ev.data.ptr = c;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1) { perror("epoll_ctl mod"); }
+    c->watching = events;
+}
+
+// Sends as much of a reply as the socket takes; the rest is queued behind any
+// earlier unsent replies and waits for EPOLLOUT. Returns 0 on a write error.
+static int send_reply(Conn* c, const void* data, size_t len) {
+    size_t off = 0;
+    while (!c->wbuf && off < len) {
+        ssize_t n = write(c->fd, (const char*)data + off, len - off);
+        if (n > 0) { off += (size_t)n; continue; }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        printf("Write error to client %d.\n", c->user_id); return 0;
+    }
+    if (off < len) {
+        size_t need = c->wlen + (len - off);
+        if (need > c->wcap) {
+            uint8_t* grown = (uint8_t*)realloc(c->wbuf, need);
+            if (!grown) { perror("realloc"); return 0; }
+            c->wbuf = grown; c->wcap = need;
+        }
+        memcpy(c->wbuf + c->wlen, (const char*)data + off, len - off);
+        c->wlen = need;
+        watch_connection(c, c->watching | EPOLLOUT);
+    }
+    return 1;
+}
+
+// Flushes a pending reply. Returns 0 on a write error.
+static int flush_reply(Conn* c) {
+    while (c->woff < c->wlen) {
+        ssize_t n = write(c->fd, c->wbuf + c->woff, c->wlen - c->woff);
+        if (n > 0) { c->woff += (size_t)n; continue; }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        printf("Write error to client %d.\n", c->user_id); return 0;
+    }
+    free(c->wbuf); c->wbuf = NULL; c->wlen = c->woff = c->wcap = 0;
+    return 1;
+}
+
+// Sends a Response in the connection's wire format, tagged like the request
+// it answers. Returns 0 on a write error.
+static int reply(Conn* c, const FrameHeader* hdr, const Response* res) {
+    static uint8_t frame[PROTO_MAX_FRAME]; // Only the reactor thread encodes replies
+    if (c->wire == WIRE_LEGACY) return send_reply(c, res, sizeof(Response));
+
+    size_t len = proto_encode_response(hdr, res, frame, sizeof(frame));
+    if (len == 0) {
+        Response err;
+        memset(&err, 0, sizeof(Response));
+        err.success = 0; strcpy(err.message, "Reply too large.");
+        len = proto_encode_response(hdr, &err, frame, sizeof(frame));
+    }
+    return send_reply(c, frame, len);
+}
+
+static int reply_error(Conn* c, const FrameHeader* hdr, const char* message) {
+    Response res;
+    memset(&res, 0, sizeof(Response));
+    res.success = 0;
+    strncpy(res.message, message, sizeof(res.message) - 1);
+    return reply(c, hdr, &res);
+}
+
+// --- Pipelining ---
+// Read-only requests that carry a request ID may run alongside each other on
+// the workers; the per-record locks in the handlers keep them consistent.
+// Anything that changes state, including LOGIN, and every request from a
+// client without request IDs runs alone and in arrival order.
+static int runs_concurrently(const FrameHeader* hdr) {
+    if (hdr->version < 2) return 0;
+    switch (hdr->op) {
+        case SERVER_STATS:
+        case CUST_VIEW_BALANCE:
+        case CUST_VIEW_HISTORY:
+        case EMP_VIEW_CUST_TX:
+        case EMP_VIEW_ASSIGNED_LOANS:
+        case MGR_REVIEW_FEEDBACK:
+        case MGR_VIEW_PENDING_LOANS:
+        case MGR_VIEW_USER_LIST:
+        case MGR_TX_QUERY:
+        case ADMIN_VIEW_USER_LIST:
+        case LIST_PAGE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int can_start(const Conn* c, const FrameHeader* hdr) {
+    if (c->exclusive || c->inflight >= MAX_PIPELINE) return 0;
+    return c->inflight == 0 || runs_concurrently(hdr);
+}
+
+// Whether the reactor should read more requests from this connection now.
+static int wants_input(const Conn* c) {
+    return !c->stalled && !c->exclusive && c->inflight < MAX_PIPELINE &&
+           c->wlen - c->woff < MAX_PENDING_OUTPUT;
+}
+
+// Queues a complete request for the workers, or answers "Server busy" at once.
+// Returns 0 if the connection should be closed.
+static int dispatch_request(Conn* c, const FrameHeader* hdr, Request* client_req) {
+    Job* job = (Job*)malloc(sizeof(Job));
+    if (job) {
+        job->conn = c;
+        job->user_id = c->user_id; job->user_role = c->user_role;
+        job->session = c->session; job->session_token = c->session_token;
+        if (c->session_token) atomic_store_explicit(&c->session->active_at, now_ns(), memory_order_relaxed);
+        job->exclusive = !runs_concurrently(hdr);
+        job->hdr = *hdr;
+        job->req = *client_req;
+        if (job_queue_push(job)) {
+            c->inflight++;
+            if (job->exclusive) c->exclusive = 1;
+            return 1;
+        }
+        free(job);
+    }
+    proto_release_request(client_req);
+    return reply_error(c, hdr, "Server busy. Please try again.");
+}
+
+// Consumes n bytes from the front of the receive buffer.
+static void consume_input(Conn* c, size_t n) {
+    c->rlen -= n;
+    if (c->rlen == 0) {
+        free(c->rbuf); c->rbuf = NULL; c->rcap = 0;
+    } else {
+        memmove(c->rbuf, c->rbuf + n, c->rlen);
+    }
+}
+
+// Extracts the next complete message from the receive buffer if it may start
+// now. Returns 1 with *hdr and *req filled (or *malformed set), 0 if more bytes
+// are needed or the request must wait (c->stalled), and -1 on a protocol error
+// that ends the connection.
+static int next_message(Conn* c, FrameHeader* hdr, Request* req, int* malformed) {
+    if (c->wire == WIRE_UNKNOWN) {
+        if (c->rlen < 2) return 0;
+        if (c->rbuf[0] == PROTO_MAGIC0 && c->rbuf[1] == PROTO_MAGIC1) c->wire = WIRE_FRAMED;
+        else if (cfg_legacy_clients) c->wire = WIRE_LEGACY;
+        else return -1;
+    }
+
+    if (c->wire == WIRE_LEGACY) {
+        if (c->rlen < sizeof(Request)) return 0;
+        memset(hdr, 0, sizeof(FrameHeader));
+        if (!can_start(c, hdr)) { c->stalled = 1; return 0; }
+        memcpy(req, c->rbuf, sizeof(Request));
+        consume_input(c, sizeof(Request));
+        *malformed = (req->op == CUST_BATCH || req->op == LIST_PAGE || req->op == MGR_TX_QUERY); // Their lists cannot cross the wire raw
+        return 1;
+    }
 
-// Canonical two-account locking to avoid deadlocks in A<->B transfers
-static inline void lock_account_pair(int a, int b) {
-    int lo = (a < b) ? a : b;
-    int hi = (a < b) ? b : a;
-    pthread_mutex_lock(&account_mutexes[lo]);
-    if (hi != lo) pthread_mutex_lock(&account_mutexes[hi]);
+    int r = proto_parse_header(c->rbuf, c->rlen, hdr);
+    if (r <= 0) return r;
+    if (c->rlen < hdr->size + hdr->length) return 0;
+    if (!can_start(c, hdr)) { c->stalled = 1; return 0; }
+    *malformed = !proto_decode_request(hdr, c->rbuf + hdr->size, req);
+    req->op = (Operation)hdr->op;
+    consume_input(c, hdr->size + hdr->length);
+    return 1;
 }
-static inline void unlock_account_pair(int a, int b) {
-    int lo = (a < b) ? a : b;
-    int hi = (a < b) ? b : a;
-    if (hi != lo) pthread_mutex_unlock(&account_mutexes[hi]);
-    pthread_mutex_unlock(&account_mutexes[lo]);
+
+// Dispatches complete requests that are already buffered.
+// Returns 0 if the connection should be closed.
+static int drain_input(Conn* c) {
+    c->stalled = 0;
+    while (wants_input(c)) {
+        FrameHeader hdr;
+        Request client_req;
+        int malformed = 0;
+        int r = next_message(c, &hdr, &client_req, &malformed);
+        if (r < 0) { printf("Protocol error from client %d.\n", c->user_id); return 0; }
+        if (r == 0) return 1;
+
+        if (malformed) {
+            if (!reply_error(c, &hdr, "Malformed request.")) return 0;
+            continue;
+        }
+        if (client_req.op == EXIT) return 0; // Will trigger session cleanup
+        if (!dispatch_request(c, &hdr, &client_req)) return 0;
+    }
+    return 1;
 }
-static inline void lock_account_one(int id)   { pthread_mutex_lock(&account_mutexes[id]); }
-static inline void unlock_account_one(int id) { pthread_mutex_unlock(&account_mutexes[id]); }
 
+// --- Streaming ---
+// A LIST_PAGE stream goes back to the workers for its next page each time a
+// page has been sent. While more than MAX_PENDING_OUTPUT is unsent the job is
+// parked on the connection instead, so a slow reader never makes the server
+// hold more than one page per stream. A parked job still counts as inflight.
+static int stream_continues(const Job* job) {
+    return job->req.op == LIST_PAGE && job->req.data.page.stream &&
+           job->res.success && job->res.data.page.next_cursor != 0;
+}
 
-// --- Function Prototypes ---
-void* handle_client_connection(void* client_socket);
-void handle_login(int sock, Request* req, Response* res);
-void handle_change_password(int sock, Request* req, Response* res); 
-void handle_customer_operations(int sock, Request* req, Response* res);
-void handle_employee_operations(int sock, Request* req, Response* res);
-void handle_manager_operations(int sock, Request* req, Response* res);
-void handle_admin_operations(int sock, Request* req, Response* res);
-void log_transaction(int acc_id, const char* type, double amount, double new_balance);
+// Sends the next page request of a stream to the workers. If the queue is
+// full the stream ends with "Server busy". Returns 0 on a write error.
+static int queue_stream(Conn* c, Job* job) {
+    if (job_queue_push(job)) { c->inflight++; return 1; }
+    int ok = reply_error(c, &job->hdr, "Server busy. Stream ended.");
+    proto_release_request(&job->req);
+    free(job);
+    return ok;
+}
 
-// --- Locking Helpers ---
-void set_record_lock(int fd, int record_id, int type, size_t struct_size) {
-    struct flock lock;
-    lock.l_type = type; lock.l_whence = SEEK_SET;
-    lock.l_start = (off_t)record_id * (off_t)struct_size;
-    lock.l_len = (off_t)struct_size; lock.l_pid = getpid();
-    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl set lock"); }
+// Takes a stream whose page was just sent on to its next page.
+// Returns 0 on a write error.
+static int continue_stream(Conn* c, Job* job) {
+    job->req.data.page.cursor = job->res.data.page.next_cursor;
+    proto_release_response(LIST_PAGE, &job->res);
+    if (c->wlen - c->woff >= MAX_PENDING_OUTPUT) {
+        job->next = c->parked; c->parked = job;
+        c->inflight++;
+        return 1;
+    }
+    return queue_stream(c, job);
 }
-void unlock_record(int fd, int record_id, size_t struct_size) {
-    struct flock lock;
-    lock.l_type = F_UNLCK; lock.l_whence = SEEK_SET;
-    lock.l_start = (off_t)record_id * (off_t)struct_size;
-    lock.l_len = (off_t)struct_size; lock.l_pid = getpid();
-    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl unlock"); }
+
+// Runs whatever is buffered, then waits for what the connection needs next:
+// the socket draining (EPOLLOUT), more input (EPOLLIN), or only its workers.
+// Returns 0 if the connection should be closed.
+static int resume_connection(Conn* c) {
+    while (c->parked && c->wlen - c->woff < MAX_PENDING_OUTPUT) {
+        Job* job = c->parked;
+        c->parked = job->next;
+        c->inflight--;
+        if (!queue_stream(c, job)) return 0;
+    }
+    if (!drain_input(c)) return 0;
+    watch_connection(c, (c->wbuf ? EPOLLOUT : 0) | (wants_input(c) ? EPOLLIN : 0));
+    return 1;
 }
-void set_file_lock(int fd, int type) {
-    struct flock lock;
-    lock.l_type = type; lock.l_whence = SEEK_SET;
-    lock.l_start = 0; lock.l_len = 0; // Lock entire file
-    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl file lock"); }
+
+// Delivers the replies of finished jobs.
+static void on_jobs_done(void) {
+    uint64_t ignored;
+    if (read(done_queue.event_fd, &ignored, sizeof(ignored)) == -1 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+    pthread_mutex_lock(&done_queue.lock);
+    Job* job = done_queue.head;
+    done_queue.head = done_queue.tail = NULL;
+    pthread_mutex_unlock(&done_queue.lock);
+
+    while (job) {
+        Job* next = job->next;
+        Conn* c = job->conn;
+        c->inflight--;
+        if (job->exclusive) {
+            c->exclusive = 0;
+            c->user_id = job->user_id; c->user_role = job->user_role;
+            c->session = job->session; c->session_token = job->session_token;
+        }
+
+        if (c->closing) {
+            if (c->inflight == 0) close_connection(c);
+        } else if (!reply(c, &job->hdr, &job->res)) {
+            close_connection(c);
+        } else if (stream_continues(job)) {
+            if (!continue_stream(c, job) || !resume_connection(c)) close_connection(c);
+            job = next;
+            continue;
+        } else if (!resume_connection(c)) {
+            close_connection(c);
+        }
+        proto_release_request(&job->req);
+        proto_release_response(job->req.op, &job->res);
+        free(job);
+        job = next;
+    }
 }
-void unlock_file(int fd) {
-    struct flock lock;
-    lock.l_type = F_UNLCK; lock.l_whence = SEEK_SET;
-    lock.l_start = 0; lock.l_len = 0;
-    if (fcntl(fd, F_SETLKW, &lock) == -1) { perror("fcntl file unlock"); }
+
+// Reads whatever is available and dispatches each complete request.
+// Returns 0 if the connection should be closed.
+static int on_readable(Conn* c) {
+    while (1) {
+        if (!drain_input(c)) return 0;
+        if (!wants_input(c)) break; // Wait for workers or for the socket to drain
+
+        if (c->rcap - c->rlen < READ_CHUNK) {
+            uint8_t* grown = (uint8_t*)realloc(c->rbuf, c->rlen + READ_CHUNK);
+            if (!grown) { perror("realloc"); return 0; }
+            c->rbuf = grown; c->rcap = c->rlen + READ_CHUNK;
+        }
+        ssize_t n = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            printf("Client disconnected (user %d).\n", c->user_id); return 0;
+        }
+        c->rlen += (size_t)n;
+    }
+    if (c->rlen == 0) { free(c->rbuf); c->rbuf = NULL; c->rcap = 0; }
+    return resume_connection(c);
 }
 
-// --- Transaction Logger (updated: serialized by txlog_mutex) ---
-void log_transaction(int acc_id, const char* type, double amount, double new_balance) {
-    pthread_mutex_lock(&txlog_mutex); // NEW
-    int fd = open(TRANSACTION_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd == -1) { perror("open TRANSACTION_FILE"); pthread_mutex_unlock(&txlog_mutex); return; }
-    
-    set_file_lock(fd, F_WRLCK); // existing cross-process safety
+static void accept_connections(int server_fd) {
+    while (1) {
+        int new_socket = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) { perror("accept"); }
+            return;
+        }
 
-    off_t offset = lseek(fd, 0, SEEK_END);
-    int trans_id = (int)(offset / (off_t)sizeof(Transaction)) + 1;
+        Conn* c = (Conn*)calloc(1, sizeof(Conn));
+        if (!c) { perror("calloc"); close(new_socket); continue; }
+        c->fd = new_socket; c->user_id = -1; c->user_role = -1;
+        c->watching = EPOLLIN;
 
-    Transaction t = {trans_id, acc_id, time(NULL), "", amount, new_balance};
-    strncpy(t.type, type, 19);
-    t.type[19] = '\0';
-    if (write(fd, &t, sizeof(Transaction)) != (ssize_t)sizeof(Transaction)) {
-        perror("write TRANSACTION_FILE");
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP; ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_socket, &ev) == -1) {
+            perror("epoll_ctl add"); close(new_socket); free(c); continue;
+        }
     }
+}
 
-    unlock_file(fd);
-    close(fd);
-    pthread_mutex_unlock(&txlog_mutex); // NEW
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-w workers] [-q queue_depth] [-b listen_backlog] [-c commit_window_ms] [-t idle_seconds] [-a live_segments] [-F] [-X]\n", prog);
+    fprintf(stderr, "  -c  how long the WAL gathers a group commit (default 2 ms, 0 syncs at once)\n");
+    fprintf(stderr, "  -t  end sessions idle this long and close their connections (default 900, 0 never)\n");
+    fprintf(stderr, "  -a  keep this many sealed log segments live and archive older ones (default 0, keep all)\n");
+    fprintf(stderr, "  -F  framed protocol only; refuse fixed-size legacy clients\n");
+    fprintf(stderr, "  -X  single owner: lock the database for this process and skip fcntl record locks\n");
+    exit(EXIT_FAILURE);
 }
 
+// Marker values for epoll_event.data.ptr that are not connections.
+static char listen_tag, jobs_done_tag, signal_tag;
 
-// --- Main Server (updated: init account mutexes) ---
-int main() {
-    int server_fd, new_socket;
+// --- Main Server (epoll reactor + worker pool) ---
+// Send SIGUSR1 to print queue and worker statistics.
+int main(int argc, char* argv[]) {
+    int server_fd;
     struct sockaddr_in address;
-    int opt = 1; socklen_t addrlen = sizeof(address);
+    int opt = 1;
 
-    // Initialize the session array to all zeros
-    memset(active_sessions, 0, sizeof(active_sessions));
-
-    // NEW: Initialize all account mutexes
-    for (int i = 0; i < MAX_ID; i++) {
-        pthread_mutex_init(&account_mutexes[i], NULL);
+    while ((opt = getopt(argc, argv, "w:q:b:c:t:a:FX")) != -1) {
+        switch (opt) {
+            case 'w': cfg_workers = atoi(optarg); break;
+            case 'q': cfg_queue_depth = atoi(optarg); break;
+            case 'b': cfg_backlog = atoi(optarg); break;
+            case 'c': cfg_commit_window_us = (int)(atof(optarg) * 1000.0); break;
+            case 't': cfg_session_timeout = atoi(optarg); break;
+            case 'a': cfg_live_segments = atoi(optarg); break;
+            case 'F': cfg_legacy_clients = 0; break;
+            case 'X': cfg_shared_db = 0; break;
+            default: usage(argv[0]);
+        }
     }
+    if (cfg_workers <= 0 || cfg_queue_depth <= 0 || cfg_backlog <= 0 ||
+        cfg_commit_window_us < 0 || cfg_commit_window_us > 1000000 || cfg_session_timeout < 0 || cfg_live_segments < 0) usage(argv[0]);
+    opt = 1;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    init_lock_manager();
+
+    signal(SIGPIPE, SIG_IGN); // A vanished client must not kill the server
+    raise_fd_limit();
+
+    // Take the port first, so a server that cannot listen leaves the database alone
+    if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
         perror("socket failed"); exit(EXIT_FAILURE);
     }
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
@@ -115,152 +3582,132 @@ int main() {
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed"); exit(EXIT_FAILURE);
     }
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
+    if (listen(server_fd, cfg_backlog) < 0) {
         perror("listen"); exit(EXIT_FAILURE);
     }
-    printf("Server listening on port %d\n", SERVER_PORT);
-    
-    while (1) {
-        new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
-        if (new_socket < 0) {
-            perror("accept"); continue;
-        }
-        
-        pthread_t thread_id;
-        int* client_sock_ptr = (int*)malloc(sizeof(int));
-        if (!client_sock_ptr) { perror("malloc"); close(new_socket); continue; }
-        *client_sock_ptr = new_socket;
+    claim_database();
+    open_databases();
+    open_txlog_segments();
+    map_accounts();
+    load_users();
+    load_loans(); // assignee index is by USER_FILE slot
 
-        if (pthread_create(&thread_id, NULL, handle_client_connection, (void*)client_sock_ptr) != 0) {
-            perror("pthread_create"); close(new_socket); free(client_sock_ptr); continue;
-        }
-        pthread_detach(thread_id);
-    }
-    close(server_fd); return 0;
-}
+    // SIGUSR1 is delivered through a signalfd; block it before any thread starts.
+    sigset_t stats_signals;
+    sigemptyset(&stats_signals); sigaddset(&stats_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_signals, NULL);
+    int signal_fd = signalfd(-1, &stats_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) { perror("signalfd"); exit(EXIT_FAILURE); }
+    start_wal();
 
-// --- Thread Connection Handler (unchanged logic) ---
-void* handle_client_connection(void* client_socket_ptr) {
-    int sock_fd = *(int*)client_socket_ptr; free(client_socket_ptr);
-    Request client_req; Response server_res;
-    int user_id = -1; // -1 means no user is logged in on this thread
-    UserRole user_role = -1;
+    start_workers();
+    start_session_reaper();
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1"); exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+        perror("epoll_ctl listen"); exit(EXIT_FAILURE);
+    }
+    ev.data.ptr = &jobs_done_tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, done_queue.event_fd, &ev) == -1) {
+        perror("epoll_ctl eventfd"); exit(EXIT_FAILURE);
+    }
+    ev.data.ptr = &signal_tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) == -1) {
+        perror("epoll_ctl signalfd"); exit(EXIT_FAILURE);
+    }
+    printf("Server listening on port %d (%d workers, queue depth %d, backlog %d)\n",
+           SERVER_PORT, cfg_workers, cfg_queue_depth, cfg_backlog);
+    fflush(stdout);
 
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        int bytes = read(sock_fd, &client_req, sizeof(Request));
-        if (bytes <= 0) {
-            printf("Client disconnected (user %d).\n", user_id); break;
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait"); break;
         }
-        memset(&server_res, 0, sizeof(Response));
-        client_req.user_id = user_id; 
-        
-        if (client_req.op == LOGIN) {
-            handle_login(sock_fd, &client_req, &server_res);
-            if (server_res.success) {
-                user_id = server_res.data.user.id; // Thread now "owns" this user_id
-                user_role = server_res.data.user.role;
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listen_tag) { accept_connections(server_fd); continue; }
+            if (tag == &jobs_done_tag) { on_jobs_done(); continue; }
+            if (tag == &signal_tag) {
+                struct signalfd_siginfo si;
+                while (read(signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) dump_stats();
+                continue;
             }
-        } else if (client_req.op == EXIT) {
-            break; // Will trigger session cleanup
-        } else if (user_id == -1) {
-            server_res.success = 0; strcpy(server_res.message, "Not logged in.");
-        } 
-        else if (client_req.op == CHANGE_PASSWORD) {
-            handle_change_password(sock_fd, &client_req, &server_res);
-        } 
-        else { // User is logged in, route to role
-            switch (user_role) {
-                case CUSTOMER:
-                    handle_customer_operations(sock_fd, &client_req, &server_res);
-                    break;
-                case EMPLOYEE:
-                    handle_employee_operations(sock_fd, &client_req, &server_res);
-                    break;
-                case MANAGER:
-                    handle_manager_operations(sock_fd, &client_req, &server_res);
-                    break;
-                case ADMIN:
-                    handle_admin_operations(sock_fd, &client_req, &server_res);
-                    break;
-                default:
-                    server_res.success = 0; strcpy(server_res.message, "Unknown user role.");
+
+            Conn* c = (Conn*)tag;
+            if (c->closing) continue; // Already handed back to close_connection
+            int keep = 1;
+            if (events[i].events & EPOLLOUT) {
+                keep = flush_reply(c) && resume_connection(c);
+            }
+            if (keep && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                keep = on_readable(c);
             }
+            if (keep && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                keep = 0; // Nobody is left to read the replies
+            }
+            if (!keep) close_connection(c);
         }
-        if (write(sock_fd, &server_res, sizeof(Response)) <= 0) {
-            printf("Write error to client %d.\n", user_id); break;
+        while (closed_conns) {
+            Conn* c = closed_conns;
+            closed_conns = c->next_closed;
+            free(c);
         }
     }
-    
-    // --- SESSION CLEANUP ---
-    if (user_id != -1) { // Only if a user was successfully logged in
-        pthread_mutex_lock(&session_lock);
-        active_sessions[user_id] = 0; // Free the session
-        pthread_mutex_unlock(&session_lock);
-        printf("Session cleared for user %d.\n", user_id);
-    }
-    // --- END SESSION CLEANUP ---
-
-    printf("Closing connection socket.\n");
-    close(sock_fd); return NULL;
+    close(epoll_fd); close(server_fd); return 0;
 }
 
 // --- Login Handler (unchanged logic) ---
-void handle_login(int sock, Request* req, Response* res) {
-    int fd_user = open(USER_FILE, O_RDONLY);
-    if (fd_user == -1) { res->success = 0; strcpy(res->message, "Server DB error."); return; }
+// Returns the token of the session a successful login opens.
+uint32_t handle_login(int sock, Request* req, Response* res, Session** session) {
     User u;
+    uint32_t token = 0;
     int user_id = atoi(req->username);
-    if (user_id <= 0 || user_id >= 5000) { 
+    if (user_id <= 0) { 
         res->success = 0; strcpy(res->message, "Invalid user ID format."); 
-        close(fd_user); return; 
+        return 0; 
     }
     
-    // Lock record to read password
-    set_record_lock(fd_user, user_id, F_RDLCK, sizeof(User));
-    lseek(fd_user, (off_t)user_id * (off_t)sizeof(User), SEEK_SET);
-    int read_success = (read(fd_user, &u, sizeof(User)) == (ssize_t)sizeof(User));
-    unlock_record(fd_user, user_id, sizeof(User));
-    close(fd_user);
-
-    if (read_success && u.id == user_id && strcmp(u.password, req->password) == 0) {
+    int read_success = user_read(user_id, &u); // snapshot read; no lock
+
+    if (read_success && strcmp(u.password, req->password) == 0) {
         
         // --- ROLE VALIDATION ---
         if (u.role != req->intended_role) {
             res->success = 0;
             strcpy(res->message, "Login failed: ID and password do not match the selected user type.");
-            return;
+            return 0;
         }
         // --- END ROLE VALIDATION ---
         
         else if (u.isActive) {
             // Check session
-            pthread_mutex_lock(&session_lock);
-            if (active_sessions[user_id] == 1) {
+            token = session_open(user_id, sock, session);
+            if (token == 0) {
                 res->success = 0;
                 strcpy(res->message, "Login failed. Please log out from your other session to log in here.");
             } else {
-                active_sessions[user_id] = 1;
                 res->success = 1;
                 strcpy(res->message, "Login successful!");
                 res->data.user = u;
             }
-            pthread_mutex_unlock(&session_lock);
         } else {
             res->success = 0; strcpy(res->message, "Account is deactivated.");
         }
     } else { res->success = 0; strcpy(res->message, "Invalid ID or password."); }
+    return token;
 }
 
 // --- Common: Change Password Handler (unchanged logic) ---
 // --- Common: Change Password Handler ---
 void handle_change_password(int sock, Request* req, Response* res) {
-    int fd_user = open(USER_FILE, O_RDWR);
-    if (fd_user == -1) { 
-        res->success = 0; 
-        strcpy(res->message, "Server DB error."); 
-        return; 
-    }
-    
     User user;
     int user_id = req->user_id; // Get ID from the session
     
@@ -268,10 +3715,9 @@ void handle_change_password(int sock, Request* req, Response* res) {
     lock_account_one(user_id);
     
     // Cross-process lock
-    set_record_lock(fd_user, user_id, F_WRLCK, sizeof(User));
+    lock_user_record(user_id, F_WRLCK);
     
-    lseek(fd_user, (off_t)user_id * (off_t)sizeof(User), SEEK_SET);
-    if (read(fd_user, &user, sizeof(User)) != (ssize_t)sizeof(User)) {
+    if (!user_read(user_id, &user)) {
         res->success = 0;
         strcpy(res->message, "User record not found.");
     } else {
@@ -279,43 +3725,256 @@ void handle_change_password(int sock, Request* req, Response* res) {
         strncpy(user.password, req->data.new_password, 99);
         user.password[99] = '\0'; // Ensure null-terminated
         
-        lseek(fd_user, (off_t)user_id * (off_t)sizeof(User), SEEK_SET);
-        write(fd_user, &user, sizeof(User));
+        user_write(&user);
         
         res->success = 1;
         strcpy(res->message, "Password changed successfully.");
     }
     
     // Unlock in reverse order
-    unlock_record(fd_user, user_id, sizeof(User));
+    unlock_user_record(user_id);
     unlock_account_one(user_id);
     // --- END FIX ---
-    
-    close(fd_user);
 }
 
-// --- Customer Handler (updated: per-account mutexes and pair locking) ---
-// --- Customer Handler (CORRECTED) ---
+// --- Paged Listings (LIST_PAGE) ---
+// Which role may read each listing; 0 for anything that is not a listing.
+static UserRole listing_role(Operation op) {
+    switch (op) {
+        case CUST_VIEW_HISTORY:       return CUSTOMER;
+        case EMP_VIEW_CUST_TX:
+        case EMP_VIEW_TX_RANGE:
+        case EMP_VIEW_ASSIGNED_LOANS: return EMPLOYEE;
+        case MGR_VIEW_PENDING_LOANS:
+        case MGR_REVIEW_FEEDBACK:
+        case MGR_VIEW_USER_LIST:
+        case MGR_AUDIT_TX_RANGE:      return MANAGER;
+        case ADMIN_VIEW_USER_LIST:    return ADMIN;
+        default:                      return 0;
+    }
+}
+
+// Reads up to max feedback entries from index *cursor in one pread. *cursor
+// becomes the index after the last one read, or 0 at the end of the file.
+static int feedback_page(uint64_t* cursor, Feedback* out, int max) {
+    int fd = db_feedback_fd;
+    set_file_lock(fd, F_RDLCK);
+    off_t size = db_size(fd);
+    off_t entries = size / (off_t)sizeof(Feedback);
+    if (*cursor > (uint64_t)entries) *cursor = (uint64_t)entries;
+    off_t offset = (off_t)*cursor * (off_t)sizeof(Feedback);
+    int count = 0;
+    if (offset < size) {
+        ssize_t got = db_pread(fd, out, (size_t)max * sizeof(Feedback), offset);
+        count = got > 0 ? (int)(got / (ssize_t)sizeof(Feedback)) : 0;
+    }
+    unlock_file(fd);
+    *cursor = (offset + (off_t)count * (off_t)sizeof(Feedback) < size) ? *cursor + (uint64_t)count : 0;
+    return count;
+}
+
+void handle_list_page(Request* req, Response* res, int user_id, UserRole role) {
+    PageRequest* pr = &req->data.page;
+    Page* page = &res->data.page;
+    if (listing_role(pr->list_op) == 0 || listing_role(pr->list_op) != role) {
+        res->success = 0; strcpy(res->message, "Listing not available."); return;
+    }
+    if (pr->limit < 1 || pr->limit > MAX_PAGE_ROWS) {
+        res->success = 0; sprintf(res->message, "Page size must be 1 to %d.", MAX_PAGE_ROWS); return;
+    }
+    if ((pr->list_op == EMP_VIEW_TX_RANGE || pr->list_op == MGR_AUDIT_TX_RANGE) && pr->from > pr->to) {
+        res->success = 0; strcpy(res->message, "Invalid time range."); return;
+    }
+
+    size_t row_size;
+    switch (pr->list_op) {
+        case CUST_VIEW_HISTORY:
+        case EMP_VIEW_CUST_TX:
+        case EMP_VIEW_TX_RANGE:
+        case MGR_AUDIT_TX_RANGE:      row_size = sizeof(Transaction); break;
+        case EMP_VIEW_ASSIGNED_LOANS:
+        case MGR_VIEW_PENDING_LOANS:  row_size = sizeof(Loan); break;
+        case MGR_REVIEW_FEEDBACK:     row_size = sizeof(Feedback); break;
+        default:                      row_size = sizeof(User); break;
+    }
+    void* rows = malloc((size_t)pr->limit * row_size);
+    if (!rows) { res->success = 0; strcpy(res->message, "Server out of memory."); return; }
+    page->rows.txs = (Transaction*)rows;
+
+    uint64_t cursor = pr->cursor;
+    int count;
+    switch (pr->list_op) {
+        case CUST_VIEW_HISTORY:
+            count = account_history(user_id, &cursor, page->rows.txs, pr->limit);
+            break;
+        case EMP_VIEW_CUST_TX:
+            count = account_history(pr->target, &cursor, page->rows.txs, pr->limit);
+            break;
+        case EMP_VIEW_TX_RANGE:
+            count = account_range(pr->target, pr->from, pr->to, &cursor, page->rows.txs, pr->limit);
+            break;
+        case MGR_AUDIT_TX_RANGE:
+            count = txlog_range(pr->from, pr->to, &cursor, page->rows.txs, pr->limit);
+            break;
+        case EMP_VIEW_ASSIGNED_LOANS:
+            count = list_pending_loans(user_id, &cursor, page->rows.loans, pr->limit, NULL);
+            break;
+        case MGR_VIEW_PENDING_LOANS:
+            count = list_pending_loans(0, &cursor, page->rows.loans, pr->limit, NULL);
+            break;
+        case MGR_REVIEW_FEEDBACK:
+            count = feedback_page(&cursor, page->rows.feedback, pr->limit);
+            break;
+        default:
+            count = list_users((UserRole)pr->target, &cursor, page->rows.users, pr->limit, NULL);
+            break;
+    }
+    if (count < 0) {
+        free(rows); page->rows.txs = NULL;
+        res->success = 0; strcpy(res->message, "Invalid cursor."); return;
+    }
+
+    page->list_op = pr->list_op;
+    page->next_cursor = cursor;
+    page->count = count;
+    res->success = 1;
+    sprintf(res->message, "%d row(s)%s.", count, cursor ? ", more to come" : "");
+}
+
+// --- Customer Handler ---
+static int compare_ids(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// CUST_BATCH: runs the items in submission order against the customer's
+// account. Every account involved is locked once, in ascending ID order, for
+// the whole batch, and all transaction records go out in one append. Items
+// fail individually; the rest of the batch still runs.
+static void handle_customer_batch(Request* req, Response* res) {
+    int cust_id = req->user_id;
+    int n = req->data.batch.count;
+    const BatchItem* items = req->data.batch.items;
+
+    int* ids = (int*)malloc((size_t)(n + 1) * sizeof(int));
+    Account* accs = (Account*)malloc((size_t)(n + 1) * sizeof(Account));
+    BatchStatus* acc_status = (BatchStatus*)malloc((size_t)(n + 1) * sizeof(BatchStatus));
+    char* dirty = (char*)calloc((size_t)n + 1, 1);
+    Transaction* txs = (Transaction*)malloc((size_t)n * 2 * sizeof(Transaction));
+    BatchResult* results = (BatchResult*)calloc((size_t)n, sizeof(BatchResult));
+    if (!ids || !accs || !acc_status || !dirty || !txs || !results) {
+        res->success = 0; strcpy(res->message, "Server out of memory.");
+        free(ids); free(accs); free(acc_status); free(dirty); free(txs); free(results);
+        return;
+    }
+
+    // The customer plus every plausible recipient, sorted and de-duplicated
+    int k = 0;
+    ids[k++] = cust_id;
+    for (int i = 0; i < n; i++) {
+        int to = items[i].to_account_id;
+        if (items[i].op == CUST_TRANSFER && to > 0 && to != cust_id) ids[k++] = to;
+    }
+    qsort(ids, (size_t)k, sizeof(int), compare_ids);
+    int unique = 0;
+    for (int i = 0; i < k; i++) {
+        if (unique == 0 || ids[unique - 1] != ids[i]) ids[unique++] = ids[i];
+    }
+    k = unique;
+
+    lock_keys(ids, k);
+
+    for (int i = 0; i < k; i++) {
+        int ok = account_read(ids[i], &accs[i]) &&
+                 accs[i].account_id == ids[i];
+        acc_status[i] = ok ? BATCH_OK : BATCH_INVALID_ACCOUNT;
+        if (!ok || ids[i] == cust_id) continue;
+
+        User to_user;
+        int user_ok = user_read(ids[i], &to_user);
+        if (!user_ok) acc_status[i] = BATCH_INVALID_ACCOUNT;
+        else if (to_user.isActive == 0) acc_status[i] = BATCH_RECIPIENT_INACTIVE;
+    }
+
+    int self = (int)((int*)bsearch(&cust_id, ids, (size_t)k, sizeof(int), compare_ids) - ids);
+    time_t now = time(NULL);
+    int ntx = 0, succeeded = 0;
+    for (int i = 0; i < n; i++) {
+        const BatchItem* item = &items[i];
+        BatchStatus status = BATCH_OK;
+        int to = -1;
+
+        if (acc_status[self] != BATCH_OK) {
+            status = BATCH_INVALID_ACCOUNT;
+        } else if (item->op != CUST_DEPOSIT && item->op != CUST_WITHDRAW && item->op != CUST_TRANSFER) {
+            status = BATCH_INVALID_OP;
+        } else if (!(item->amount > 0)) {
+            status = BATCH_INVALID_AMOUNT;
+        } else if (item->op == CUST_TRANSFER) {
+            int* found = (item->to_account_id != cust_id)
+                ? (int*)bsearch(&item->to_account_id, ids, (size_t)k, sizeof(int), compare_ids) : NULL;
+            if (!found) status = BATCH_INVALID_ACCOUNT;
+            else { to = (int)(found - ids); status = acc_status[to]; }
+        }
+        if (status == BATCH_OK && item->op != CUST_DEPOSIT && accs[self].balance < item->amount) {
+            status = BATCH_INSUFFICIENT_FUNDS;
+        }
+
+        if (status == BATCH_OK) {
+            switch (item->op) {
+                case CUST_DEPOSIT:
+                    accs[self].balance += item->amount;
+                    set_tx(&txs[ntx++], cust_id, now, "DEPOSIT", item->amount, accs[self].balance);
+                    break;
+                case CUST_WITHDRAW:
+                    accs[self].balance -= item->amount;
+                    set_tx(&txs[ntx++], cust_id, now, "WITHDRAW", item->amount, accs[self].balance);
+                    break;
+                default: // CUST_TRANSFER
+                    accs[self].balance -= item->amount;
+                    accs[to].balance += item->amount;
+                    dirty[to] = 1;
+                    set_tx(&txs[ntx++], cust_id, now, "TRANSFER_OUT", item->amount, accs[self].balance);
+                    set_tx(&txs[ntx++], ids[to], now, "TRANSFER_IN", item->amount, accs[to].balance);
+                    break;
+            }
+            dirty[self] = 1;
+            succeeded++;
+        }
+        results[i].status = status;
+        results[i].new_balance = accs[self].balance;
+    }
+
+    // The changed accounts become one WAL entry with every record of the batch
+    int nimg = 0;
+    for (int i = 0; i < k; i++) {
+        if (dirty[i]) accs[nimg++] = accs[i];
+    }
+    if (nimg > 0) commit_update(accs, nimg, txs, ntx);
+
+    unlock_keys(ids, k);
+
+    res->success = 1;
+    res->data.batch.count = n;
+    res->data.batch.succeeded = succeeded;
+    res->data.batch.results = results;
+    sprintf(res->message, "Batch processed: %d of %d succeeded.", succeeded, n);
+
+    free(ids); free(accs); free(acc_status); free(dirty); free(txs);
+}
+
 void handle_customer_operations(int sock, Request* req, Response* res) {
-    int fd_account = -1, fd_loan = -1, fd_feedback = -1, fd_trans = -1;
+    int fd_loan = db_loan_fd, fd_feedback = db_feedback_fd;
     Account acc;
+    Transaction tx;
     int cust_id = req->user_id;
     
-    // Open fd_account ONCE at the top
-    if (req->op == CUST_VIEW_BALANCE || req->op == CUST_DEPOSIT || req->op == CUST_WITHDRAW || req->op == CUST_TRANSFER) {
-        fd_account = open(ACCOUNT_FILE, O_RDWR);
-        if (fd_account == -1) { res->success = 0; strcpy(res->message, "Server DB error."); return; }
-    }
-    
     switch (req->op) {
         case CUST_VIEW_BALANCE:
-            lock_account_one(cust_id); 
-            set_record_lock(fd_account, cust_id, F_RDLCK, sizeof(Account));
-            lseek(fd_account, (off_t)cust_id * (off_t)sizeof(Account), SEEK_SET);
-            read(fd_account, &acc, sizeof(Account));
-            unlock_record(fd_account, cust_id, sizeof(Account));
-            unlock_account_one(cust_id); 
+            // No lock: see account_read_optimistic()
+            int found = account_read_optimistic(cust_id, &acc);
             
+            if (!found) { res->success = 0; strcpy(res->message, "Account not found."); break; }
             res->success = 1; 
             res->data.balance = acc.balance; 
             sprintf(res->message, "Balance: $%.2f", acc.balance);
@@ -323,35 +3982,32 @@ void handle_customer_operations(int sock, Request* req, Response* res) {
             
         case CUST_DEPOSIT:
             lock_account_one(cust_id); 
-            set_record_lock(fd_account, cust_id, F_WRLCK, sizeof(Account));
-            lseek(fd_account, (off_t)cust_id * (off_t)sizeof(Account), SEEK_SET);
-            read(fd_account, &acc, sizeof(Account));
+            if (!account_read(cust_id, &acc)) {
+                unlock_account_one(cust_id); 
+                res->success = 0; strcpy(res->message, "Account not found.");
+                break;
+            }
             acc.balance += req->data.amount;
-            lseek(fd_account, (off_t)cust_id * (off_t)sizeof(Account), SEEK_SET);
-            write(fd_account, &acc, sizeof(Account));
-            unlock_record(fd_account, cust_id, sizeof(Account));
+            set_tx(&tx, cust_id, time(NULL), "DEPOSIT", req->data.amount, acc.balance);
+            commit_update(&acc, 1, &tx, 1);
             unlock_account_one(cust_id); 
             
-            log_transaction(cust_id, "DEPOSIT", req->data.amount, acc.balance);
             res->success = 1; sprintf(res->message, "Deposit successful. New balance: $%.2f", acc.balance);
             break;
 
         case CUST_WITHDRAW:
             lock_account_one(cust_id); 
-            set_record_lock(fd_account, cust_id, F_WRLCK, sizeof(Account));
-            lseek(fd_account, (off_t)cust_id * (off_t)sizeof(Account), SEEK_SET);
-            read(fd_account, &acc, sizeof(Account));
-            if (acc.balance >= req->data.amount) {
+            if (!account_read(cust_id, &acc)) {
+                unlock_account_one(cust_id); 
+                res->success = 0; strcpy(res->message, "Account not found.");
+            } else if (acc.balance >= req->data.amount) {
                 acc.balance -= req->data.amount;
-                lseek(fd_account, (off_t)cust_id * (off_t)sizeof(Account), SEEK_SET);
-                write(fd_account, &acc, sizeof(Account));
-                unlock_record(fd_account, cust_id, sizeof(Account));
+                set_tx(&tx, cust_id, time(NULL), "WITHDRAW", req->data.amount, acc.balance);
+                commit_update(&acc, 1, &tx, 1);
                 unlock_account_one(cust_id); 
                 
-                log_transaction(cust_id, "WITHDRAW", req->data.amount, acc.balance);
                 res->success = 1; sprintf(res->message, "Withdrawal successful. New balance: $%.2f", acc.balance);
             } else {
-                unlock_record(fd_account, cust_id, sizeof(Account));
                 unlock_account_one(cust_id); 
                 res->success = 0; strcpy(res->message, "Insufficient funds.");
             }
@@ -363,50 +4019,27 @@ void handle_customer_operations(int sock, Request* req, Response* res) {
                 int to_id = req->data.transfer.to_account_id;
                 double amount = req->data.transfer.amount;
 
-                // --- NEW FIX: Validate to_id is within mutex array bounds ---
-                if (to_id <= 0 || to_id >= MAX_ID) {
+                if (to_id <= 0) {
                     res->success = 0; strcpy(res->message, "Transfer failed: Invalid recipient ID.");
-                    break; // This break is safe, fd_account will be closed at the end
-                }
-                // --- END FIX ---
-
-                int fd_user = open(USER_FILE, O_RDONLY);
-                if (fd_user == -1) {
-                    res->success = 0; strcpy(res->message, "Server DB error (user file).");
-                    break; 
+                    break;
                 }
                 
                 if (from_id == to_id) {
                     res->success = 0; strcpy(res->message, "Cannot transfer to self.");
-                    close(fd_user); 
                     break; 
                 }
                 
                 Account from_acc, to_acc;
                 User to_user; 
                 int read_from_ok, read_to_ok, read_user_ok;
-                int success = 0; // Flag for logging
 
                 lock_account_pair(from_id, to_id);
-
-                if (from_id < to_id) {
-                    set_record_lock(fd_account, from_id, F_WRLCK, sizeof(Account));
-                    set_record_lock(fd_account, to_id,   F_WRLCK, sizeof(Account));
-                } else {
-                    set_record_lock(fd_account, to_id,   F_WRLCK, sizeof(Account));
-                    set_record_lock(fd_account, from_id, F_WRLCK, sizeof(Account));
-                }
                 
-                lseek(fd_account, (off_t)from_id * (off_t)sizeof(Account), SEEK_SET);
-                read_from_ok = (read(fd_account, &from_acc, sizeof(Account)) == (ssize_t)sizeof(Account));
+                read_from_ok = account_read(from_id, &from_acc);
                 
-                lseek(fd_account, (off_t)to_id * (off_t)sizeof(Account), SEEK_SET);
-                read_to_ok = (read(fd_account, &to_acc, sizeof(Account)) == (ssize_t)sizeof(Account));
+                read_to_ok = account_read(to_id, &to_acc);
                 
-                set_record_lock(fd_user, to_id, F_RDLCK, sizeof(User));
-                lseek(fd_user, (off_t)to_id * (off_t)sizeof(User), SEEK_SET);
-                read_user_ok = (read(fd_user, &to_user, sizeof(User)) == (ssize_t)sizeof(User));
-                unlock_record(fd_user, to_id, sizeof(User));
+                read_user_ok = user_read(to_id, &to_user);
                 
                 if (!read_from_ok) {
                     res->success = 0; strcpy(res->message, "Transfer failed: Sender account invalid.");
@@ -414,7 +4047,7 @@ void handle_customer_operations(int sock, Request* req, Response* res) {
                 else if (!read_to_ok) {
                     res->success = 0; strcpy(res->message, "Transfer failed: Recipient account invalid.");
                 }
-                else if (!read_user_ok || to_user.id != to_id) {
+                else if (!read_user_ok) {
                     res->success = 0; strcpy(res->message, "Transfer failed: Recipient user not found.");
                 }
                 else if (to_user.isActive == 0) { 
@@ -429,99 +4062,66 @@ void handle_customer_operations(int sock, Request* req, Response* res) {
                 else {
                     from_acc.balance -= amount;
                     to_acc.balance += amount;
-                    
-                    lseek(fd_account, (off_t)from_id * (off_t)sizeof(Account), SEEK_SET);
-                    write(fd_account, &from_acc, sizeof(Account));
-                    
-                    lseek(fd_account, (off_t)to_id * (off_t)sizeof(Account), SEEK_SET);
-                    write(fd_account, &to_acc, sizeof(Account));
-                    
-                    success = 1; 
+
+                    // Both sides and both records are one WAL entry
+                    Account images[2] = { from_acc, to_acc };
+                    Transaction txs[2];
+                    time_t now = time(NULL);
+                    set_tx(&txs[0], from_id, now, "TRANSFER_OUT", amount, from_acc.balance);
+                    set_tx(&txs[1], to_id, now, "TRANSFER_IN", amount, to_acc.balance);
+                    commit_update(images, 2, txs, 2);
                     res->success = 1; sprintf(res->message, "Transfer successful. New balance: $%.2f", from_acc.balance);
                 }
                 
-                if (from_id < to_id) {
-                    unlock_record(fd_account, to_id,   sizeof(Account));
-                    unlock_record(fd_account, from_id, sizeof(Account));
-                } else {
-                    unlock_record(fd_account, from_id, sizeof(Account));
-                    unlock_record(fd_account, to_id,   sizeof(Account));
-                }
-
                 unlock_account_pair(from_id, to_id); 
-                
-                close(fd_user); // Close the user file
-
-                if (success) {
-                    log_transaction(from_id, "TRANSFER_OUT", amount, from_acc.balance);
-                    log_transaction(to_id, "TRANSFER_IN",  amount, to_acc.balance);
-                }
             }
             break;
             
         case CUST_APPLY_LOAN:
-            fd_loan = open(LOAN_FILE, O_RDWR | O_APPEND | O_CREAT, 0644);
-            if (fd_loan == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
+            pthread_mutex_lock(&loan_append_mutex);
             set_file_lock(fd_loan, F_WRLCK);
-            off_t offset = lseek(fd_loan, 0, SEEK_END);
-            int loan_id = (int)(offset / (off_t)sizeof(Loan)) + 1;
-            Loan new_loan = {loan_id, cust_id, req->data.amount, "PENDING", 0};
-            write(fd_loan, &new_loan, sizeof(Loan));
-            unlock_file(fd_loan); close(fd_loan);
+            off_t offset = db_size(fd_loan);
+            int loan_id = (int)((offset + (off_t)sizeof(LoanRecord) - 1) / (off_t)sizeof(LoanRecord));
+            LoanRecord new_loan = {loan_id, cust_id, req->data.amount, LOAN_PENDING, 0};
+            loan_write(&new_loan);
+            loan_index_update(NULL, &new_loan);
+            unlock_file(fd_loan);
+            pthread_mutex_unlock(&loan_append_mutex);
             res->success = 1; strcpy(res->message, "Loan application submitted.");
             break;
 
         case CUST_ADD_FEEDBACK: 
-            fd_feedback = open(FEEDBACK_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
-            if (fd_feedback == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
+            pthread_mutex_lock(&feedback_append_mutex);
             set_file_lock(fd_feedback, F_WRLCK);
-            off_t fb_offset = lseek(fd_feedback, 0, SEEK_END);
+            off_t fb_offset = db_size(fd_feedback);
             int fb_id = (int)(fb_offset / (off_t)sizeof(Feedback)) + 1;
             Feedback new_fb = {fb_id, cust_id, "", time(NULL)};
             strncpy(new_fb.message, req->data.feedback_message, 511);
             new_fb.message[511] = '\0';
-            write(fd_feedback, &new_fb, sizeof(Feedback));
-            unlock_file(fd_feedback); close(fd_feedback);
+            db_pwrite(fd_feedback, &new_fb, sizeof(Feedback), fb_offset);
+            unlock_file(fd_feedback);
+            pthread_mutex_unlock(&feedback_append_mutex);
             res->success = 1; strcpy(res->message, "Feedback submitted. Thank you!");
             break;
 
         case CUST_VIEW_HISTORY: 
             {
-                fd_trans = open(TRANSACTION_FILE, O_RDONLY);
-                if(fd_trans == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
-                
-                set_file_lock(fd_trans, F_RDLCK);
-                
-                Transaction tx;
-                int count = 0;
-                off_t f_offset = lseek(fd_trans, 0, SEEK_END);
-                while(count < MAX_TRANSACTIONS && f_offset > 0) {
-                    f_offset -= (off_t)sizeof(Transaction);
-                    lseek(fd_trans, f_offset, SEEK_SET);
-                    
-                    if (read(fd_trans, &tx, sizeof(Transaction)) == (ssize_t)sizeof(Transaction)) {
-                        if(tx.account_id == cust_id) {
-                            res->data.tx_history.history[count] = tx;
-                            count++;
-                        }
-                    }
-                }
-                
-                unlock_file(fd_trans);
-                close(fd_trans);
+                uint64_t cursor = 0;
+                int count = account_history(cust_id, &cursor, res->data.tx_history.history, MAX_TRANSACTIONS);
                 
                 res->success = 1;
                 res->data.tx_history.history_count = count;
                 sprintf(res->message, "Found %d transaction(s).", count);
             }
             break;
+
+        case CUST_BATCH:
+            handle_customer_batch(req, res);
+            break;
             
         default:
             res->success = 0; strcpy(res->message, "Unknown customer operation.");
     }
-    
-    // This is the ONLY place fd_account should be closed.
-    if (fd_account != -1) close(fd_account);
 }
 
 // --- Employee Handler (unchanged) ---
@@ -530,32 +4130,9 @@ void handle_employee_operations(int sock, Request* req, Response* res) {
     switch (req->op) {
         case EMP_ADD_CUSTOMER: 
             { 
-                int fd_user = open(USER_FILE, O_RDWR | O_CREAT, 0644);
-                int fd_account = open(ACCOUNT_FILE, O_RDWR | O_CREAT, 0644);
-                if (fd_user == -1 || fd_account == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
-                
-                User user;
-                set_file_lock(fd_user, F_WRLCK); 
-                int new_cust_id = 1001;
-                while(1) {
-                    lseek(fd_user, (off_t)new_cust_id * (off_t)sizeof(User), SEEK_SET);
-                    
-                    if (read(fd_user, &user, sizeof(User)) <= 0) {
-                        break; // Hit physical end of file, slot is free
-                    }
-                    if (user.id == 0) {
-                        break; // Found an empty (zeroed) slot
-                    }
-
-                    new_cust_id++;
-                    if (new_cust_id >= 2000) { 
-                        res->success=0; strcpy(res->message, "No IDs available."); 
-                        break;
-                    }
-                }
-
-                if (new_cust_id >= 2000) {
-                    unlock_file(fd_user); close(fd_user); close(fd_account);
+                int new_cust_id = user_id_alloc(CUSTOMER);
+                if (new_cust_id == 0) {
+                    res->success=0; strcpy(res->message, "No IDs available."); 
                     return;
                 }
                 
@@ -565,31 +4142,28 @@ void handle_employee_operations(int sock, Request* req, Response* res) {
                 new_cust.isActive = 1;
                 sprintf(new_cust.username, "%d", new_cust_id);
                 
-                lseek(fd_user, (off_t)new_cust_id * (off_t)sizeof(User), SEEK_SET);
-                write(fd_user, &new_cust, sizeof(User));
-                unlock_file(fd_user); close(fd_user);
+                if (!keyed_append(&user_store, &new_cust)) {
+                    user_id_free(new_cust_id);
+                    res->success=0; strcpy(res->message, "Could not create customer."); 
+                    return;
+                }
+                user_index_update(new_cust_id, 0, CUSTOMER);
                 
                 Account acc = {new_cust_id, new_cust_id, 0.0};
-                set_record_lock(fd_account, new_cust_id, F_WRLCK, sizeof(Account));
-                lseek(fd_account, (off_t)new_cust_id * (off_t)sizeof(Account), SEEK_SET);
-                write(fd_account, &acc, sizeof(Account));
-                unlock_record(fd_account, new_cust_id, sizeof(Account)); close(fd_account);
+                keyed_append(&account_store, &acc);
                 res->success = 1; sprintf(res->message, "Customer created. ID: %d", new_cust_id);
             }
             break;
 
         case EMP_MOD_CUSTOMER: 
             {
-                int fd_user = open(USER_FILE, O_RDWR);
-                if (fd_user == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
-                
                 int target_id = req->data.target_user_id;
                 User user;
                 
-                set_record_lock(fd_user, target_id, F_WRLCK, sizeof(User));
+                lock_account_one(target_id);
+                lock_user_record(target_id, F_WRLCK);
                 
-                lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                if (read(fd_user, &user, sizeof(User)) <= 0) {
+                if (!user_read(target_id, &user)) {
                     res->success = 0;
                     strcpy(res->message, "User record not found.");
                 } else if (user.role != CUSTOMER) {
@@ -599,35 +4173,20 @@ void handle_employee_operations(int sock, Request* req, Response* res) {
                     strncpy(user.name, req->data.user_data.name, 99);
                     user.name[99] = '\0';
                     
-                    lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                    write(fd_user, &user, sizeof(User));
+                    user_write(&user);
                     res->success = 1;
                     strcpy(res->message, "Customer details updated.");
                 }
-                unlock_record(fd_user, target_id, sizeof(User));
-                close(fd_user);
+                unlock_user_record(target_id);
+                unlock_account_one(target_id);
             }
             break;
             
         case EMP_VIEW_ASSIGNED_LOANS: 
             {
-                int fd_loan = open(LOAN_FILE, O_RDONLY);
-                if (fd_loan == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-
-                set_file_lock(fd_loan, F_RDLCK); 
-                Loan loan;
-                int count = 0;
-                int employee_id = req->user_id; 
-                
-                while (read(fd_loan, &loan, sizeof(Loan)) == (ssize_t)sizeof(Loan)) {
-                    if (strcmp(loan.status, "PENDING") == 0 && loan.assigned_to_employee_id == employee_id) {
-                        if (count < 20) { 
-                            res->data.loan_list.loans[count] = loan;
-                        }
-                        count++;
-                    }
-                }
-                unlock_file(fd_loan); close(fd_loan);
+                uint64_t cursor = 0;
+                int count;
+                list_pending_loans(req->user_id, &cursor, res->data.loan_list.loans, LOAN_LIST_MAX, &count);
 
                 res->success = 1;
                 res->data.loan_list.loan_count = count;
@@ -637,83 +4196,63 @@ void handle_employee_operations(int sock, Request* req, Response* res) {
 
         case EMP_PROCESS_LOAN: 
             { 
-                int fd_loan = open(LOAN_FILE, O_RDWR);
-                int fd_account = -1;
-                if (fd_loan == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
+                int fd_loan = db_loan_fd;
 
-                Loan loan;
+                LoanRecord loan, old;
                 Account acc;
+                Transaction tx;
                 int loan_id_to_process = req->data.loan_action.loan_id;
-                int loan_index = loan_id_to_process - 1; 
 
-                set_record_lock(fd_loan, loan_index, F_WRLCK, sizeof(Loan));
+                // A loan's customer never changes, so it can be read before the lock
+                int ids[2] = { loan_id_to_process, 0 }, nids = 1;
+                if (loan_read(loan_id_to_process, &loan)) ids[nids++] = loan.customer_id;
+                lock_keys(ids, nids);
+                set_record_lock(fd_loan, loan_id_to_process, F_WRLCK, sizeof(LoanRecord));
                 
-                lseek(fd_loan, (off_t)loan_index * (off_t)sizeof(Loan), SEEK_SET); 
-                if(read(fd_loan, &loan, sizeof(Loan)) <= 0 || loan.loan_id != loan_id_to_process) {
+                if (!loan_read(loan_id_to_process, &loan)) {
                      res->success = 0; strcpy(res->message, "Loan ID not found.");
                 } 
                 else if (loan.assigned_to_employee_id != req->user_id) {
                      res->success = 0; strcpy(res->message, "This loan is not assigned to you.");
                 }
-                else if (strcmp(loan.status, "PENDING") != 0) {
+                else if (loan.status != LOAN_PENDING) {
                      res->success = 0; strcpy(res->message, "Loan is not pending.");
                 }
                 else if (req->data.loan_action.approve) {
-                    strcpy(loan.status, "APPROVED");
-                    fd_account = open(ACCOUNT_FILE, O_RDWR);
-                    set_record_lock(fd_account, loan.customer_id, F_WRLCK, sizeof(Account));
-                    lseek(fd_account, (off_t)loan.customer_id * (off_t)sizeof(Account), SEEK_SET);
-                    read(fd_account, &acc, sizeof(Account));
-                    acc.balance += loan.amount;
-                    lseek(fd_account, (off_t)loan.customer_id * (off_t)sizeof(Account), SEEK_SET);
-                    write(fd_account, &acc, sizeof(Account));
-                    unlock_record(fd_account, loan.customer_id, sizeof(Account));
-                    close(fd_account);
-                    log_transaction(loan.customer_id, "LOAN_DEPOSIT", loan.amount, acc.balance);
-                    strcpy(res->message, "Loan approved and funds deposited.");
-                    res->success = 1;
+                    old = loan;
+                    loan.status = LOAN_APPROVED;
+                    if (account_read(loan.customer_id, &acc)) {
+                        acc.balance += loan.amount;
+                        set_tx(&tx, loan.customer_id, time(NULL), "LOAN_DEPOSIT", loan.amount, acc.balance);
+                        commit_update(&acc, 1, &tx, 1);
+                        strcpy(res->message, "Loan approved and funds deposited.");
+                        res->success = 1;
+                    } else {
+                        strcpy(res->message, "Customer account not found.");
+                        res->success = 0;
+                    }
                 } else {
-                    strcpy(loan.status, "REJECTED");
+                    old = loan;
+                    loan.status = LOAN_REJECTED;
                     strcpy(res->message, "Loan rejected.");
                     res->success = 1;
                 }
                 
                 if(res->success) {
-                    lseek(fd_loan, (off_t)loan_index * (off_t)sizeof(Loan), SEEK_SET);
-                    write(fd_loan, &loan, sizeof(Loan));
+                    loan_write(&loan);
+                    loan_index_update(&old, &loan);
                 }
                 
-                unlock_record(fd_loan, loan_index, sizeof(Loan));
-                close(fd_loan);
+                unlock_record(fd_loan, loan_id_to_process, sizeof(LoanRecord));
+                unlock_keys(ids, nids);
             }
             break;
 
         case EMP_VIEW_CUST_TX: 
             {
-                int fd_trans = open(TRANSACTION_FILE, O_RDONLY);
-                if(fd_trans == -1) { res->success = 0; strcpy(res->message, "Server DB error."); break; }
-                
                 int target_cust_id = req->data.target_user_id;
-                
-                set_file_lock(fd_trans, F_RDLCK);
-                
-                Transaction tx;
-                int count = 0;
-                off_t f_offset = lseek(fd_trans, 0, SEEK_END);
-                while(count < MAX_TRANSACTIONS && f_offset > 0) {
-                    f_offset -= (off_t)sizeof(Transaction);
-                    lseek(fd_trans, f_offset, SEEK_SET);
-                    
-                    if (read(fd_trans, &tx, sizeof(Transaction)) == (ssize_t)sizeof(Transaction)) {
-                        if(tx.account_id == target_cust_id) {
-                            res->data.tx_history.history[count] = tx;
-                            count++;
-                        }
-                    }
-                }
-                
-                unlock_file(fd_trans);
-                close(fd_trans);
+                uint64_t cursor = 0;
+                int count = account_history(target_cust_id, &cursor, res->data.tx_history.history, MAX_TRANSACTIONS);
                 
                 res->success = 1;
                 res->data.tx_history.history_count = count;
@@ -728,19 +4267,17 @@ void handle_employee_operations(int sock, Request* req, Response* res) {
 
 // --- Manager Handler (unchanged) ---
 void handle_manager_operations(int sock, Request* req, Response* res) {
-    int fd_user, fd_loan, fd_feedback;
-    User user; Loan loan; Feedback fb;
+    int fd_loan, fd_feedback;
+    User user; LoanRecord loan; Feedback fb;
     
     switch (req->op) {
         case MGR_ACTIVATE_USER:
         case MGR_DEACTIVATE_USER:
             {
                 int target_id = req->data.target_user_id;
-                fd_user = open(USER_FILE, O_RDWR);
-                if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                set_record_lock(fd_user, target_id, F_WRLCK, sizeof(User));
-                lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                if (read(fd_user, &user, sizeof(User)) <= 0) {
+                lock_account_one(target_id);
+                lock_user_record(target_id, F_WRLCK);
+                if (!user_read(target_id, &user)) {
                     res->success = 0; strcpy(res->message, "User not found.");
                 } else if (user.role != CUSTOMER) {
                      res->success = 0; strcpy(res->message, "Can only manage Customer accounts.");
@@ -752,8 +4289,7 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
                             sprintf(res->message, "User %d is already activated.", target_id);
                         } else {
                             user.isActive = 1;
-                            lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                            write(fd_user, &user, sizeof(User));
+                            user_write(&user);
                             res->success = 1;
                             sprintf(res->message, "User %d activated.", target_id);
                         }
@@ -763,15 +4299,14 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
                             sprintf(res->message, "User %d is already deactivated.", target_id);
                         } else {
                             user.isActive = 0;
-                            lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                            write(fd_user, &user, sizeof(User));
+                            user_write(&user);
                             res->success = 1;
                             sprintf(res->message, "User %d deactivated.", target_id);
                         }
                     }
                 }
-                unlock_record(fd_user, target_id, sizeof(User));
-                close(fd_user);
+                unlock_user_record(target_id);
+                unlock_account_one(target_id);
             }
             break;
 
@@ -780,61 +4315,50 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
                 int emp_id = req->data.loan_assignment.employee_id;
                 
                 // --- VALIDATION: Check if emp_id is a real Employee ---
-                fd_user = open(USER_FILE, O_RDONLY);
-                if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                
-                set_record_lock(fd_user, emp_id, F_RDLCK, sizeof(User));
-                lseek(fd_user, (off_t)emp_id * (off_t)sizeof(User), SEEK_SET);
-                if (read(fd_user, &user, sizeof(User)) != (ssize_t)sizeof(User)) {
+                if (!user_read(emp_id, &user)) {
                     res->success = 0; strcpy(res->message, "Employee ID not found.");
-                    unlock_record(fd_user, emp_id, sizeof(User));
-                    close(fd_user);
                     break;
                 }
                 
                 if (user.role != EMPLOYEE) {
                     res->success = 0; strcpy(res->message, "Invalid ID. You must assign to an Employee.");
-                    unlock_record(fd_user, emp_id, sizeof(User));
-                    close(fd_user);
                     break;
                 }
-                unlock_record(fd_user, emp_id, sizeof(User));
-                close(fd_user);
                 // --- END VALIDATION ---
 
-                fd_loan = open(LOAN_FILE, O_RDWR);
-                if (fd_loan == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
+                fd_loan = db_loan_fd;
                 
                 int loan_id = req->data.loan_assignment.loan_id;
-                int loan_index = loan_id - 1; 
                 
-                set_record_lock(fd_loan, loan_index, F_WRLCK, sizeof(Loan));
-                lseek(fd_loan, (off_t)loan_index * (off_t)sizeof(Loan), SEEK_SET);
-                if (read(fd_loan, &loan, sizeof(Loan)) <= 0 || loan.loan_id != loan_id) {
+                lock_keys(&loan_id, 1);
+                set_record_lock(fd_loan, loan_id, F_WRLCK, sizeof(LoanRecord));
+                if (!loan_read(loan_id, &loan)) {
                     res->success = 0; strcpy(res->message, "Loan not found.");
-                } else if (strcmp(loan.status, "PENDING") != 0) {
+                } else if (loan.status != LOAN_PENDING) {
                     res->success = 0; strcpy(res->message, "Loan is not pending.");
                 } else {
+                    LoanRecord old = loan;
                     loan.assigned_to_employee_id = emp_id;
-                    lseek(fd_loan, (off_t)loan_index * (off_t)sizeof(Loan), SEEK_SET);
-                    write(fd_loan, &loan, sizeof(Loan));
+                    loan_write(&loan);
+                    loan_index_update(&old, &loan);
                     res->success = 1;
                     sprintf(res->message, "Loan %d assigned to employee %d.", loan_id, emp_id);
                 }
-                unlock_record(fd_loan, loan_index, sizeof(Loan));
-                close(fd_loan);
+                unlock_record(fd_loan, loan_id, sizeof(LoanRecord));
+                unlock_keys(&loan_id, 1);
             }
             break;
 
         case MGR_REVIEW_FEEDBACK:
-            fd_feedback = open(FEEDBACK_FILE, O_RDONLY);
-            if (fd_feedback == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
+            fd_feedback = db_feedback_fd;
             set_file_lock(fd_feedback, F_RDLCK);
             int count = 0;
-            while(read(fd_feedback, &fb, sizeof(Feedback)) == (ssize_t)sizeof(Feedback) && count < 50) {
+            RecordScan scan;
+            scan_begin(&scan, fd_feedback, sizeof(Feedback));
+            while(count < 50 && scan_next(&scan, &fb)) {
                 res->data.feedback.list[count++] = fb;
             }
-            unlock_file(fd_feedback); close(fd_feedback);
+            unlock_file(fd_feedback);
             res->data.feedback.count = count;
             res->success = 1;
             sprintf(res->message, "Found %d feedback entries.", count);
@@ -842,20 +4366,9 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
 
         case MGR_VIEW_PENDING_LOANS: 
             {
-                int fd_loan = open(LOAN_FILE, O_RDONLY);
-                if (fd_loan == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                set_file_lock(fd_loan, F_RDLCK);
-                Loan loan;
-                int count = 0;
-                while (read(fd_loan, &loan, sizeof(Loan)) == (ssize_t)sizeof(Loan)) {
-                    if (strcmp(loan.status, "PENDING") == 0) {
-                        if (count < 20) { 
-                            res->data.loan_list.loans[count] = loan;
-                        }
-                        count++;
-                    }
-                }
-                unlock_file(fd_loan); close(fd_loan);
+                uint64_t cursor = 0;
+                int count;
+                list_pending_loans(0, &cursor, res->data.loan_list.loans, LOAN_LIST_MAX, &count);
                 res->success = 1;
                 res->data.loan_list.loan_count = count;
                 sprintf(res->message, "Found %d total pending loan(s).", count);
@@ -864,26 +4377,10 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
 
         case MGR_VIEW_USER_LIST: 
             {
-                fd_user = open(USER_FILE, O_RDONLY);
-                if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                
                 UserRole role_to_list = req->data.user_data.role;
-                int count = 0;
-                
-                set_file_lock(fd_user, F_RDLCK);
-                lseek(fd_user, 0, SEEK_SET); 
-                
-                while(read(fd_user, &user, sizeof(User)) == (ssize_t)sizeof(User)) {
-                    if (user.id != 0 && user.role == role_to_list) {
-                        if(count < MAX_USER_LIST) {
-                            res->data.user_list.list[count] = user;
-                        }
-                        count++;
-                    }
-                }
-                
-                unlock_file(fd_user);
-                close(fd_user);
+                uint64_t cursor = 0;
+                int count;
+                list_users(role_to_list, &cursor, res->data.user_list.list, MAX_USER_LIST, &count);
                 
                 res->success = 1;
                 res->data.user_list.count = count;
@@ -891,6 +4388,10 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
             }
             break;
 
+        case MGR_TX_QUERY:
+            handle_tx_query(req, res);
+            break;
+
         default:
             res->success = 0; strcpy(res->message, "Unknown manager operation.");
     }
@@ -898,61 +4399,28 @@ void handle_manager_operations(int sock, Request* req, Response* res) {
 
 // --- Admin Handler (unchanged) ---
 void handle_admin_operations(int sock, Request* req, Response* res) {
-    int fd_user; 
     User user;
     
     switch (req->op) {
         case ADMIN_ADD_USER:
-            fd_user = open(USER_FILE, O_RDWR | O_CREAT, 0644); 
-            if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-            set_file_lock(fd_user, F_WRLCK); 
+            if (!valid_role(req->data.user_data.role)) { res->success=0; strcpy(res->message, "Invalid role."); break; }
             User new_user = req->data.user_data; 
-            int start_id = 0, end_id = 0;
-            
-            if(new_user.role == CUSTOMER) { start_id = 1001; end_id = 1999; }
-            else if(new_user.role == EMPLOYEE) { start_id = 2001; end_id = 2999; }
-            else if(new_user.role == MANAGER) { start_id = 3001; end_id = 3999; }
-            else if(new_user.role == ADMIN) { start_id = 4001; end_id = 4999; }
-            else { res->success=0; strcpy(res->message, "Invalid role."); break; }
-
-            int new_id = start_id;
-            while(1) {
-                lseek(fd_user, (off_t)new_id * (off_t)sizeof(User), SEEK_SET);
-                
-                if (read(fd_user, &user, sizeof(User)) <= 0) {
-                    break; // Hit physical end of file, slot is free
-                }
-                if (user.id == 0) {
-                    break; // Found an empty (zeroed) slot
-                }
-                
-                new_id++;
-                if (new_id > end_id) { res->success=0; strcpy(res->message, "No IDs available for this role."); break; }
-            }
-            
-            if (new_id > end_id) { // Check if loop broke due to being full
-                unlock_file(fd_user); close(fd_user);
-                break;
-            }
+
+            int new_id = user_id_alloc(new_user.role);
+            if (new_id == 0) { res->success=0; strcpy(res->message, "No IDs available for this role."); break; }
 
             new_user.id = new_id; 
             new_user.isActive = 1;
             sprintf(new_user.username, "%d", new_id);
             
-            lseek(fd_user, (off_t)new_id * (off_t)sizeof(User), SEEK_SET);
-            write(fd_user, &new_user, sizeof(User));
+            if (!keyed_append(&user_store, &new_user)) { user_id_free(new_id); res->success=0; strcpy(res->message, "Could not create user."); break; }
+            user_index_update(new_id, 0, new_user.role);
             
             if (new_user.role == CUSTOMER) {
-                int fd_account = open(ACCOUNT_FILE, O_RDWR | O_CREAT, 0644);
                 Account acc = {new_id, new_id, 0.0};
-                set_record_lock(fd_account, new_id, F_WRLCK, sizeof(Account));
-                lseek(fd_account, (off_t)new_id * (off_t)sizeof(Account), SEEK_SET);
-                write(fd_account, &acc, sizeof(Account));
-                unlock_record(fd_account, new_id, sizeof(Account));
-                close(fd_account);
+                keyed_append(&account_store, &acc);
             }
             
-            unlock_file(fd_user); close(fd_user);
             res->success = 1;
             sprintf(res->message, "User created. New ID: %d", new_id);
             break;
@@ -960,52 +4428,35 @@ void handle_admin_operations(int sock, Request* req, Response* res) {
         case ADMIN_MOD_USER:
             {
                 int target_id = req->data.target_user_id;
-                fd_user = open(USER_FILE, O_RDWR);
-                if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                set_record_lock(fd_user, target_id, F_WRLCK, sizeof(User));
-                lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                if (read(fd_user, &user, sizeof(User)) <= 0) {
+                lock_account_one(target_id);
+                lock_user_record(target_id, F_WRLCK);
+                if (!user_read(target_id, &user)) {
                     res->success = 0; strcpy(res->message, "User not found.");
                 } else {
                     User updated_data = req->data.user_data;
+                    UserRole old_role = user.role;
                     strcpy(user.name, updated_data.name);
                     strcpy(user.password, updated_data.password);
                     user.role = updated_data.role;
                     user.isActive = updated_data.isActive;
                     sprintf(user.username, "%d", user.id);
                     
-                    lseek(fd_user, (off_t)target_id * (off_t)sizeof(User), SEEK_SET);
-                    write(fd_user, &user, sizeof(User));
+                    user_write(&user);
+                    if (user.role != old_role) user_index_update(user.id, old_role, user.role);
                     res->success = 1;
                     sprintf(res->message, "User %d updated.", target_id);
                 }
-                unlock_record(fd_user, target_id, sizeof(User));
-                close(fd_user);
+                unlock_user_record(target_id);
+                unlock_account_one(target_id);
             }
             break;
 
         case ADMIN_VIEW_USER_LIST: 
             {
-                fd_user = open(USER_FILE, O_RDONLY);
-                if (fd_user == -1) { res->success=0; strcpy(res->message, "Server DB error."); break; }
-                
                 UserRole role_to_list = req->data.user_data.role;
-                int count = 0;
-                
-                set_file_lock(fd_user, F_RDLCK);
-                lseek(fd_user, 0, SEEK_SET); // Start from beginning
-                
-                while(read(fd_user, &user, sizeof(User)) == (ssize_t)sizeof(User)) {
-                    if (user.id != 0 && user.role == role_to_list) {
-                        if(count < MAX_USER_LIST) {
-                            res->data.user_list.list[count] = user;
-                        }
-                        count++;
-                    }
-                }
-                
-                unlock_file(fd_user);
-                close(fd_user);
+                uint64_t cursor = 0;
+                int count;
+                list_users(role_to_list, &cursor, res->data.user_list.list, MAX_USER_LIST, &count);
                 
                 res->success = 1;
                 res->data.user_list.count = count;